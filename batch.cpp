@@ -0,0 +1,432 @@
+//
+//  batch.cpp
+//  Batch renderer for animations and parameter sweeps. A job file lists the
+//  renders, one job per line; the frames are split into units that worker
+//  processes take in turn, each worker rendering with its own solver and
+//  handing finished images to a writer thread, so encoding and disk writes
+//  overlap the next frame. Headless and CPU only, like rc_headless.
+//
+#include <SDL3/SDL.h>
+#include "headers/geometry.hpp"
+#include "headers/radiance.hpp"
+#include "headers/scenes.hpp"
+#include "headers/image_io.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define BATCH_FORK
+#endif
+
+using namespace std;
+
+// an object moved by (dx, dy) every frame, frame 0 is the scene as loaded
+struct batch_move_t {
+    int   obj;
+    float dx, dy;
+};
+
+// one line of the job file with its sweeps expanded
+struct batch_job_t {
+    int    line = 0;                    // in the job file
+    string scene = "default", out = "job{job}_{frame}.png";
+    int    w = 512, h = 512;
+    bool   size_given = false;
+    int    d0 = ::d0, r0 = ::r0, rl0 = ::rl0;
+    int    s_res = s_res_factor, a_res = a_res_factor, len_res = ray_len_factor;
+    int    cascades = 0;
+    int    rc_format = cascade_format, light = light_format;
+    int    dist = dist_mode, tracer = tracer_mode, solve = solver, hrc = hrc_d0;
+    bool   mip = march_mip, cells = march_cells;
+    int    frames = 1;
+    vector<batch_move_t> moves;
+};
+
+// The options that take a comma list, every combination becoming a job of
+// its own. Output patterns refer to them by the same names.
+const pair<const char*, int batch_job_t::*> batch_sweeps[] = {
+    {"w",   &batch_job_t::w},     {"h",     &batch_job_t::h},
+    {"d0",  &batch_job_t::d0},    {"r0",    &batch_job_t::r0},    {"rl0",     &batch_job_t::rl0},
+    {"s-res", &batch_job_t::s_res}, {"a-res", &batch_job_t::a_res}, {"len-res", &batch_job_t::len_res},
+};
+
+// frames [first, first + count) of a job, what a worker takes at a time
+struct batch_unit_t {
+    int job, first, count;
+};
+
+// lives in memory the workers share
+struct batch_shared_t {
+    std::atomic<int>  next;             // first unit nobody took yet
+    std::atomic<long> frames;           // written
+};
+
+void usage() {
+    printf("usage: rc_batch JOBFILE [options]\n"
+           "  -j N               worker processes, 0 = one per hardware thread (default)\n"
+           "  -t N               solver threads per worker, default hardware threads / workers\n"
+           "  -d                 deterministic scheduling\n"
+           "  --chunk N          frames of an animation a worker takes at once, default 32\n"
+           "  --incremental      compute animation frames from the one before, faster but\n"
+           "                     not bit for bit the full frame\n"
+           "  --list             print the frames and their files, render nothing\n"
+           "Job file: one job per line, '#' starts a comment. Options as for rc_headless:\n"
+           "  --scene NAME -w W -h H --d0 N --r0 N --rl0 N --s-res N --a-res N --len-res N\n"
+           "  --cascades N --rc-format F --light-format F --dist-mode M --mip --cells\n"
+           "  --tracer T --solver S --hrc-d0 N\n"
+           "and\n"
+           "  --frames N         frames of the job, default 1\n"
+           "  --move N DX DY     move object N by (DX, DY) every frame, repeatable\n"
+           "  -o PATTERN         output file, default job{job}_{frame}.png\n"
+           "-w, -h, --d0, --r0, --rl0, --s-res, --a-res and --len-res take comma lists\n"
+           "(--d0 1,2,4), a job for every combination. In the pattern {frame} is the\n"
+           "frame (4 digits), {job} the job and {w}, {d0}, {s-res}, ... the values.\n");
+}
+
+// comma separated positive numbers, false for anything else
+bool parse_list(const string& s, vector<int>& out) {
+    out.clear();
+    const char* p = s.c_str();
+    for (;;) {
+        char* end;
+        long  v = strtol(p, &end, 10);
+        if (end == p || v <= 0) return false;
+        out.push_back(static_cast<int>(v));
+        if (*end == 0) return true;
+        if (*end != ',') return false;
+        p = end + 1;
+    }
+}
+
+// Parses the options of one line into `job`, the comma lists into `sweeps`.
+// False with a message on stderr for anything it does not know.
+bool parse_job(const vector<string>& args, batch_job_t& job, vector<pair<int, vector<int>>>& sweeps) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string& a = args[i];
+        bool has_val = i + 1 < args.size();
+        int  sweep = -1;
+        for (int k = 0; k < static_cast<int>(size(batch_sweeps)); ++k)
+            if (a == (strlen(batch_sweeps[k].first) == 1 ? "-" : "--") + string(batch_sweeps[k].first)) sweep = k;
+
+        if (sweep >= 0 && has_val) {
+            vector<int> values;
+            if (!parse_list(args[++i], values)) {
+                fprintf(stderr, "line %d: %s takes positive numbers, not \"%s\"\n", job.line, a.c_str(), args[i].c_str());
+                return false;
+            }
+            if (sweep <= 1) job.size_given = true;
+            sweeps.push_back({sweep, values});
+        }
+        else if (a == "-o"             && has_val) job.out = args[++i];
+        else if (a == "--scene"        && has_val) job.scene = args[++i];
+        else if (a == "--cascades"     && has_val) job.cascades = atoi(args[++i].c_str());
+        else if (a == "--rc-format"    && has_val) job.rc_format = parse_color_format(args[++i].c_str());
+        else if (a == "--light-format" && has_val) job.light = parse_color_format(args[++i].c_str());
+        else if (a == "--dist-mode"    && has_val) job.dist = args[++i] == "analytic" ? DIST_ANALYTIC : DIST_EDT;
+        else if (a == "--mip")                     job.mip = true;
+        else if (a == "--cells")                   job.cells = true;
+        else if (a == "--tracer"       && has_val) {
+            const string& v = args[++i];
+            job.tracer = v == "auto" ? TRACER_AUTO : v == "dda" ? TRACER_DDA : TRACER_SPHERE;
+        }
+        else if (a == "--solver"       && has_val) job.solve = args[++i] == "hrc" ? SOLVER_HRC : SOLVER_RC;
+        else if (a == "--hrc-d0"       && has_val) job.hrc = atoi(args[++i].c_str());
+        else if (a == "--frames"       && has_val) job.frames = atoi(args[++i].c_str());
+        else if (a == "--move"         && i + 3 < args.size()) {
+            batch_move_t m;
+            m.obj = atoi(args[++i].c_str());
+            m.dx  = static_cast<float>(atof(args[++i].c_str()));
+            m.dy  = static_cast<float>(atof(args[++i].c_str()));
+            job.moves.push_back(m);
+        }
+        else {
+            fprintf(stderr, "line %d: unknown option or missing value \"%s\"\n", job.line, a.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// the rc_headless checks, plus the frames
+bool valid_job(const batch_job_t& j) {
+    if (j.w <= 0 || j.h <= 0 || j.d0 <= 0 || j.r0 <= 0 || j.rl0 <= 0 || j.hrc <= 0 || j.s_res < 2 || j.a_res < 1 ||
+        j.len_res < 2 || j.frames < 1) {
+        fprintf(stderr, "line %d: invalid resolution, cascade configuration or frame count\n", j.line);
+        return false;
+    }
+    return true;
+}
+
+// Reads the job file and expands every line into a job per combination of
+// its comma lists, in the order they appear. Scene files without -w/-h
+// render at the size they were laid out for.
+bool read_jobs(const string& path, vector<batch_job_t>& jobs) {
+    ifstream f(path);
+    if (!f) {
+        fprintf(stderr, "Could not read job file \"%s\"\n", path.c_str());
+        return false;
+    }
+    string text;
+    for (int line = 1; getline(f, text); ++line) {
+        text = text.substr(0, text.find('#'));
+        istringstream ss(text);
+        vector<string> args;
+        for (string a; ss >> a; ) args.push_back(a);
+        if (args.empty()) continue;
+
+        batch_job_t job;
+        job.line = line;
+        vector<pair<int, vector<int>>> sweeps;
+        if (!parse_job(args, job, sweeps)) return false;
+        int file_w, file_h;
+        if (!job.size_given && !is_builtin_scene(job.scene) && scene_file_size(job.scene, file_w, file_h)) {
+            job.w = file_w;
+            job.h = file_h;
+        }
+
+        // odometer over the lists, the last one turning fastest
+        vector<size_t> at(sweeps.size(), 0);
+        for (;;) {
+            batch_job_t j = job;
+            for (size_t k = 0; k < sweeps.size(); ++k) j.*batch_sweeps[sweeps[k].first].second = sweeps[k].second[at[k]];
+            if (!valid_job(j)) return false;
+            jobs.push_back(j);
+            size_t k = sweeps.size();
+            while (k > 0 && ++at[k - 1] == sweeps[k - 1].second.size()) at[--k] = 0;
+            if (k == 0) break;
+        }
+    }
+    return true;
+}
+
+// the file frame `frame` of job `index` goes to
+string output_path(const batch_job_t& job, int index, int frame) {
+    auto value = [&](const string& key, string& v) {
+        char buf[16];
+        if (key == "frame") snprintf(buf, sizeof(buf), "%04d", frame);
+        else if (key == "job") snprintf(buf, sizeof(buf), "%d", index);
+        else {
+            bool found = false;
+            for (const auto& s : batch_sweeps)
+                if (key == s.first) {
+                    snprintf(buf, sizeof(buf), "%d", job.*s.second);
+                    found = true;
+                }
+            if (!found) return false;
+        }
+        v = buf;
+        return true;
+    };
+    string out;
+    for (size_t i = 0; i < job.out.size(); ++i) {
+        size_t close = job.out[i] == '{' ? job.out.find('}', i) : string::npos;
+        string v;
+        if (close != string::npos && value(job.out.substr(i + 1, close - i - 1), v)) {
+            out += v;
+            i = close;
+        }
+        else
+            out += job.out[i];
+    }
+    return out;
+}
+
+image_t light_image() {
+    image_t img(scr_w, scr_h);
+    for (int x = 0; x < scr_w; ++x)
+        for (int y = 0; y < scr_h; ++y) {
+            SDL_FColor c = buf_light.at(px(x, y));
+            float* o = img.at(x, y);
+            o[0] = c.r; o[1] = c.g; o[2] = c.b;
+        }
+    return img;
+}
+
+// Renders the frames of one unit. The solver is set up for the job and the
+// scene loaded afresh, then every frame puts the moved objects where they
+// are at that frame and is computed in full, so it comes out the same
+// whichever unit renders it. With `incremental` the frames after the first
+// only redo what the moves reach, which is faster but carries the small
+// differences of incremental frames (see rc_headless --move).
+bool render_unit(const batch_job_t& job, int index, const batch_unit_t& unit, bool incremental, image_writer_t& writer) {
+    scr_w = job.w; scr_h = job.h;
+    d0 = job.d0; r0 = job.r0; rl0 = job.rl0;
+    s_res_factor = job.s_res; a_res_factor = job.a_res; ray_len_factor = job.len_res;
+    cascade_format = job.rc_format; light_format = job.light;
+    dist_mode = job.dist; tracer_mode = job.tracer; solver = job.solve; hrc_d0 = job.hrc;
+    march_mip = job.mip; march_cells = job.cells;
+    if (!init_solver(job.cascades)) return false;
+    if (!load_scene(job.scene)) {
+        fprintf(stderr, "line %d: could not load scene \"%s\"\n", job.line, job.scene.c_str());
+        return false;
+    }
+    invalidate_scene();
+
+    // where the moved objects start, moves of the same object add up
+    map<int, vec2> start;
+    for (const batch_move_t& m : job.moves) {
+        if (m.obj < 0 || m.obj >= static_cast<int>(objects.size())) {
+            fprintf(stderr, "line %d: no object %d to move, the scene has %zu\n", job.line, m.obj, objects.size());
+            return false;
+        }
+        start[m.obj] = objects[m.obj]->centre;
+    }
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    for (int frame = unit.first; frame < unit.first + unit.count; ++frame) {
+        for (auto& s : start) {
+            vec2 c = s.second;
+            for (const batch_move_t& m : job.moves)
+                if (m.obj == s.first) c = c + vec2(m.dx, m.dy) * static_cast<float>(frame);
+            if (!(c == objects[s.first]->centre)) move_object(s.first, c);
+        }
+        if (!incremental) invalidate_scene();
+        compute(true);
+        writer.push(output_path(job, index, frame), light_image());
+    }
+    printf("job %d frames %d-%d: %.3f ms per frame\n", index, unit.first, unit.first + unit.count - 1,
+           ms_since(t0) / unit.count);
+    return true;
+}
+
+// takes units until none are left
+void run_worker(const vector<batch_job_t>& jobs, const vector<batch_unit_t>& units, bool incremental,
+                batch_shared_t& shared) {
+    image_writer_t writer;
+    for (int u; (u = shared.next++) < static_cast<int>(units.size()); ) {
+        const batch_unit_t& unit = units[u];
+        render_unit(jobs[unit.job], unit.job, unit, incremental, writer);
+        fflush(stdout);
+    }
+    writer.finish();
+    free_solver();
+    shared.frames += writer.written();
+}
+
+int main(int argc, char* argv[]) {
+    string job_path;
+    int  workers = 0, chunk = 32;
+    bool threads_given = false, list = false, incremental = false;
+
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if      (a == "-j"      && has_val) workers = atoi(argv[++i]);
+        else if (a == "-t"      && has_val) { n_threads = atoi(argv[++i]); threads_given = true; }
+        else if (a == "-d")                 deterministic = true;
+        else if (a == "--chunk" && has_val) chunk = max(1, atoi(argv[++i]));
+        else if (a == "--list")             list = true;
+        else if (a == "--incremental")      incremental = true;
+        else if (a[0] != '-' && job_path.empty()) job_path = a;
+        else {
+            usage();
+            return a == "--help" ? 0 : 1;
+        }
+    }
+    if (job_path.empty()) {
+        usage();
+        return 1;
+    }
+
+    vector<batch_job_t> jobs;
+    if (!read_jobs(job_path, jobs)) return 1;
+
+    // two frames writing one file would make the batch depend on timing
+    vector<batch_unit_t> units;
+    map<string, pair<int, int>> files;      // path -> job, frame
+    long total = 0;
+    for (int j = 0; j < static_cast<int>(jobs.size()); ++j) {
+        for (int f = 0; f < jobs[j].frames; ++f) {
+            string path = output_path(jobs[j], j, f);
+            auto seen = files.find(path);
+            if (seen != files.end()) {
+                fprintf(stderr, "line %d: job %d frame %d and job %d frame %d both write %s, add {job} or {frame} to -o\n",
+                        jobs[j].line, seen->second.first, seen->second.second, j, f, path.c_str());
+                return 1;
+            }
+            files[path] = {j, f};
+            if (list) printf("job %d (line %d) frame %d: %s\n", j, jobs[j].line, f, path.c_str());
+        }
+        for (int f = 0; f < jobs[j].frames; f += chunk) units.push_back({j, f, min(chunk, jobs[j].frames - f)});
+        total += jobs[j].frames;
+    }
+    if (list) return 0;
+
+    int hw = max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    if (workers <= 0) workers = hw;
+    workers = max(1, min(workers, static_cast<int>(units.size())));
+    if (!threads_given) n_threads = max(1, hw / workers);
+#ifndef BATCH_FORK
+    workers = 1;
+#endif
+    printf("%zu jobs, %ld frames in %zu units, %d workers of %d threads\n", jobs.size(), total, units.size(), workers,
+           n_threads);
+    fflush(stdout);
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    batch_shared_t* shared;
+#ifdef BATCH_FORK
+    // the counters live in memory the forked workers share
+    void* mem = mmap(nullptr, sizeof(batch_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "Could not map the shared counters\n");
+        return 1;
+    }
+    shared = new (mem) batch_shared_t();
+#else
+    batch_shared_t local;
+    shared = &local;
+#endif
+    shared->next = 0;
+    shared->frames = 0;
+
+    if (workers == 1)
+        run_worker(jobs, units, incremental, *shared);
+#ifdef BATCH_FORK
+    else {
+        // no thread is running yet (the pool starts in init_solver()), so
+        // forking is safe; jobs, units and mapped scene files stay shared
+        // until written to
+        vector<pid_t> children;
+        for (int w = 0; w < workers; ++w) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                run_worker(jobs, units, incremental, *shared);
+                fflush(stdout);
+                _exit(0);
+            }
+            if (pid < 0) {
+                fprintf(stderr, "Could not start worker %d\n", w);
+                break;
+            }
+            children.push_back(pid);
+        }
+        // a worker that died took its frames with it
+        for (pid_t pid : children) {
+            int status;
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                fprintf(stderr, "Worker %d did not finish\n", static_cast<int>(pid));
+        }
+    }
+#endif
+
+    double ms = ms_since(t0);
+    long frames = shared->frames, failed = total - frames;
+    printf("%ld frames in %.3f s, %.0f frames per hour\n", frames, ms / 1000.0, frames / (ms / 3600000.0));
+    if (failed > 0) fprintf(stderr, "%ld frames were not written\n", failed);
+#ifdef BATCH_FORK
+    munmap(mem, sizeof(batch_shared_t));
+#endif
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+//
+//  bench.cpp
+//  Fixed benchmark suite: every built-in scene at several resolutions and
+//  cascade configurations, each pipeline stage timed on its own. Results go
+//  out as JSON, one case per line, and can be checked against an earlier run
+//  to flag regressions. Headless and CPU only, like rc_headless.
+//
+#include <SDL3/SDL.h>
+#include "headers/geometry.hpp"
+#include "headers/radiance.hpp"
+#include "headers/scenes.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct bench_config_t {
+    const char* name;
+    int d0, r0, rl0, s_res, a_res, len_res;
+};
+
+// the specialised merges and marchers (4 and 16 rays) and the generic path
+const bench_config_t bench_configs[] = {
+    {"r4",      1, 4,  2, 2, 4, 4},
+    {"r16",     2, 16, 4, 2, 4, 4},
+    {"generic", 2, 9,  2, 2, 4, 4},
+};
+
+// the viewer's scene, dense clutter, thin walls, many small lights
+const char* bench_scenes[] = {"default", "scatter:100000", "maze:32", "emitters:5000"};
+
+const int bench_sizes[] = {256, 512, 1024};
+
+// median of every stage over the timed frames
+struct bench_result_t {
+    string name;
+    map<string, double> stages;     // ms
+    long rays = 0, steps = 0;
+};
+
+void usage() {
+    printf("usage: rc_bench [options]\n"
+           "  -o FILE            results as JSON, default bench.json\n"
+           "  --baseline FILE    compare with an earlier run, exit 1 on a regression\n"
+           "  --threshold F      slowdown that counts as a regression, default 0.15\n"
+           "  --noise MS         ignore differences below this, default 0.5\n"
+           "  --reps N           timed frames per case after a warm-up, default 5\n"
+           "  --quick            only 256 and 512 pixels\n"
+           "  --only TEXT        only cases whose name contains TEXT\n"
+           "  -t N               worker threads, 0 = all\n"
+           "  -d                 deterministic scheduling\n"
+           "Cases are named scene@size/config, configs:\n");
+    for (const bench_config_t& c : bench_configs)
+        printf("  %-8s --d0 %d --r0 %d --rl0 %d --s-res %d --a-res %d --len-res %d\n",
+               c.name, c.d0, c.r0, c.rl0, c.s_res, c.a_res, c.len_res);
+}
+
+double median(vector<double> v) {
+    sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// full frames of one scene at one size and config, false if it cannot be set up
+bool run_case(const string& scene, int size, const bench_config_t& c, int reps, bench_result_t& r) {
+    scr_w = scr_h = size;
+    d0 = c.d0; r0 = c.r0; rl0 = c.rl0;
+    s_res_factor = c.s_res; a_res_factor = c.a_res; ray_len_factor = c.len_res;
+    if (!init_solver() || !load_scene(scene)) return false;
+
+    map<string, vector<double>> samples;
+    for (int i = 0; i <= reps; ++i) {
+        invalidate_scene();
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        compute(true);
+        double total = ms_since(t0);
+        // the first frame warms the caches and the pool
+        if (i == 0) continue;
+        samples["objects"].push_back(stage_times.obj);
+        samples["distance"].push_back(stage_times.dist);
+        for (size_t Cn = 0; Cn < stage_times.cascade.size(); ++Cn)
+            samples["cascade" + to_string(Cn)].push_back(stage_times.cascade[Cn]);
+        samples["merge"].push_back(stage_times.merge);
+        samples["total"].push_back(total);
+    }
+    for (auto& s : samples) r.stages[s.first] = median(s.second);
+    r.rays  = stage_times.rays;
+    r.steps = stage_times.steps;
+    return true;
+}
+
+void write_result(FILE* f, const bench_result_t& r, const string& scene, int size, const bench_config_t& c) {
+    fprintf(f, "{\"name\":\"%s\",\"scene\":\"%s\",\"w\":%d,\"h\":%d,\"config\":\"%s\",\"threads\":%d,\"stages\":{",
+            r.name.c_str(), scene.c_str(), size, size, c.name, pool.size());
+    const char* sep = "";
+    for (const auto& s : r.stages) {
+        fprintf(f, "%s\"%s\":%.4f", sep, s.first.c_str(), s.second);
+        sep = ",";
+    }
+    fprintf(f, "},\"rays\":%ld,\"steps\":%ld}\n", r.rays, r.steps);
+}
+
+// Reads the lines write_result() wrote; anything else is skipped. Only the
+// name, the stages and the counters are needed.
+bool read_baseline(const string& path, map<string, bench_result_t>& out) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return false;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        const char* name   = strstr(line, "\"name\":\"");
+        const char* stages = strstr(line, "\"stages\":{");
+        if (!name || !stages) continue;
+        bench_result_t r;
+        name += 8;
+        r.name.assign(name, strcspn(name, "\""));
+        for (const char* p = stages + 10; *p == '"'; ) {
+            char   key[64];
+            double ms;
+            int    n;
+            if (sscanf(p, "\"%63[^\"]\":%lf%n", key, &ms, &n) != 2) break;
+            r.stages[key] = ms;
+            p += n;
+            if (*p == ',') ++p;
+        }
+        if (const char* p = strstr(line, "\"rays\":"))  r.rays  = atol(p + 7);
+        if (const char* p = strstr(line, "\"steps\":")) r.steps = atol(p + 8);
+        out[r.name] = r;
+    }
+    fclose(f);
+    return true;
+}
+
+// Stages that got slower by more than `threshold` and `noise` ms, and marching
+// that does more lookups than before (counted, so free of timing noise).
+// Returns the number of regressions.
+int compare(const bench_result_t& r, const bench_result_t& base, double threshold, double noise) {
+    int regressions = 0;
+    for (const auto& s : r.stages) {
+        auto b = base.stages.find(s.first);
+        if (b == base.stages.end()) continue;
+        double diff = s.second - b->second;
+        if (diff > noise && s.second > b->second * (1.0 + threshold)) {
+            printf("  REGRESSION %-10s %10.3f ms, was %10.3f ms (%+.1f%%)\n", s.first.c_str(), s.second, b->second,
+                   100.0 * diff / b->second);
+            ++regressions;
+        }
+    }
+    if (base.steps > 0 && r.steps > base.steps * (1.0 + threshold)) {
+        printf("  REGRESSION %ld distance lookups, was %ld\n", r.steps, base.steps);
+        ++regressions;
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+    string out = "bench.json", baseline_path, only;
+    double threshold = 0.15, noise = 0.5;
+    int reps = 5;
+    bool quick = false;
+
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if      (a == "-o"          && has_val) out = argv[++i];
+        else if (a == "--baseline"  && has_val) baseline_path = argv[++i];
+        else if (a == "--threshold" && has_val) threshold = atof(argv[++i]);
+        else if (a == "--noise"     && has_val) noise = atof(argv[++i]);
+        else if (a == "--reps"      && has_val) reps = max(1, atoi(argv[++i]));
+        else if (a == "--quick")                quick = true;
+        else if (a == "--only"      && has_val) only = argv[++i];
+        else if (a == "-t"          && has_val) n_threads = atoi(argv[++i]);
+        else if (a == "-d")                     deterministic = true;
+        else {
+            usage();
+            return a == "--help" ? 0 : 1;
+        }
+    }
+
+    map<string, bench_result_t> baseline;
+    if (!baseline_path.empty() && !read_baseline(baseline_path, baseline)) {
+        fprintf(stderr, "Could not read baseline \"%s\"\n", baseline_path.c_str());
+        return 1;
+    }
+    FILE* f = fopen(out.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "Could not write \"%s\"\n", out.c_str());
+        return 1;
+    }
+
+    int cases = 0, regressions = 0;
+    bool ok = true;
+    for (const char* scene : bench_scenes)
+        for (int size : bench_sizes) {
+            if (quick && size > 512) continue;
+            for (const bench_config_t& c : bench_configs) {
+                bench_result_t r;
+                r.name = string(scene) + "@" + to_string(size) + "/" + c.name;
+                if (!only.empty() && r.name.find(only) == string::npos) continue;
+                if (!run_case(scene, size, c, reps, r)) {
+                    fprintf(stderr, "Could not run %s\n", r.name.c_str());
+                    ok = false;
+                    continue;
+                }
+                ++cases;
+                double cascades_ms = 0;
+                for (const auto& s : r.stages)
+                    if (s.first.compare(0, 7, "cascade") == 0) cascades_ms += s.second;
+                printf("%-32s %10.3f ms total, %10.3f ms cascades, %.2f lookups per ray\n", r.name.c_str(),
+                       r.stages["total"], cascades_ms, r.rays ? static_cast<double>(r.steps) / r.rays : 0.0);
+                write_result(f, r, scene, size, c);
+                fflush(f);
+
+                auto b = baseline.find(r.name);
+                if (b != baseline.end()) regressions += compare(r, b->second, threshold, noise);
+                else if (!baseline.empty()) printf("  not in the baseline\n");
+            }
+        }
+    ok &= fclose(f) == 0;
+    free_solver();
+
+    printf("%d cases written to %s\n", cases, out.c_str());
+    if (!baseline.empty())
+        printf("%d regressions against %s (threshold %.0f%%, noise %.2f ms)\n", regressions, baseline_path.c_str(),
+               100.0 * threshold, noise);
+    return ok && regressions == 0 ? 0 : 1;
+}
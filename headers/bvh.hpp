@@ -0,0 +1,182 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "geometry.hpp"
+
+// Bounding volume hierarchy over the scene objects, so SDF evaluation,
+// picking and rasterisation only look at the objects near a point or tile
+// instead of scanning all of them.
+//
+// Built top down by median split of the box centres along the longer axis,
+// stored flat with the two children of a node next to each other and always
+// after their parent. Moving objects only refits the boxes, the tree shape
+// stays until the next build().
+//
+// Every query reports objects by their index in `objects`, and the order the
+// callers rely on (first object containing a point, draw order) is kept by
+// comparing indices, never by traversal order.
+
+const int BVH_LEAF_SIZE = 4;
+
+struct bvh_node_t {
+    aabb_t box;
+    int first = 0, count = 0;   // leaf: items [first, first + count); inner: children first, first + 1
+    int parent = -1;
+};
+
+struct object_bvh_t {
+    std::vector<bvh_node_t> nodes;
+    std::vector<int>        items;      // object indices, grouped by leaf
+    std::vector<aabb_t>     boxes;      // aabb() of every object at the last build/refit
+    std::vector<int>        leaf_of;    // leaf holding every object
+
+    void build(const std::vector<std::unique_ptr<Object>>& objects) {
+        int n = static_cast<int>(objects.size());
+        boxes.resize(n);
+        items.resize(n);
+        leaf_of.assign(n, 0);
+        for (int i = 0; i < n; ++i) {
+            boxes[i] = objects[i]->aabb();
+            items[i] = i;
+        }
+        nodes.clear();
+        nodes.reserve(n > 0 ? 2 * ((n + BVH_LEAF_SIZE - 1) / BVH_LEAF_SIZE) : 1);
+        nodes.push_back(bvh_node_t());
+        split(0, 0, n);
+    }
+
+    // takes the current aabb() of every object, O(n)
+    void refit(const std::vector<std::unique_ptr<Object>>& objects) {
+        for (size_t i = 0; i < boxes.size(); ++i) boxes[i] = objects[i]->aabb();
+        for (int k = static_cast<int>(nodes.size()) - 1; k >= 0; --k) fit(k);
+    }
+
+    // takes the current aabb() of object i, O(depth)
+    void refit(const std::vector<std::unique_ptr<Object>>& objects, int i) {
+        boxes[i] = objects[i]->aabb();
+        for (int k = leaf_of[i]; k >= 0; k = nodes[k].parent) fit(k);
+    }
+
+    // min over all objects of sdf(p), or `max` when none is closer
+    float nearest(const std::vector<std::unique_ptr<Object>>& objects, vec2 p, float max) const {
+        float best = max;
+        if (items.empty()) return best;
+        // a node whose box is farther than best + slack cannot hold anything
+        // closer; the slack absorbs rounding between sdf() and dist_sq()
+        const float slack = 0.01f;
+        int stack[64], top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const bvh_node_t& node = nodes[stack[--top]];
+            float lim = best + slack;
+            if (node.box.dist_sq(p) > (lim > 0 ? lim * lim : 0.0f)) continue;
+            if (node.count > 0) {
+                for (int k = node.first; k < node.first + node.count; ++k) {
+                    float d = objects[items[k]]->sdf(p);
+                    if (d < best) best = d;
+                }
+                continue;
+            }
+            // nearer child on top of the stack
+            float d0 = nodes[node.first].box.dist_sq(p), d1 = nodes[node.first + 1].box.dist_sq(p);
+            stack[top++] = d0 <= d1 ? node.first + 1 : node.first;
+            stack[top++] = d0 <= d1 ? node.first : node.first + 1;
+        }
+        return best;
+    }
+
+    // lowest index of an object with sdf(p) <= 0, -1 if there is none
+    int pick(const std::vector<std::unique_ptr<Object>>& objects, vec2 p) const {
+        int found = -1;
+        if (items.empty()) return found;
+        int stack[64], top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const bvh_node_t& node = nodes[stack[--top]];
+            if (!node.box.contains(p)) continue;
+            if (node.count > 0) {
+                for (int k = node.first; k < node.first + node.count; ++k) {
+                    int i = items[k];
+                    if ((found < 0 || i < found) && boxes[i].contains(p) && objects[i]->sdf(p) <= 0.0f)
+                        found = i;
+                }
+                continue;
+            }
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+        return found;
+    }
+
+    // indices of the objects whose box overlaps `box`, ascending
+    void query(const aabb_t& box, std::vector<int>& out) const {
+        out.clear();
+        if (items.empty()) return;
+        int stack[64], top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const bvh_node_t& node = nodes[stack[--top]];
+            if (!node.box.overlaps(box)) continue;
+            if (node.count > 0) {
+                for (int k = node.first; k < node.first + node.count; ++k)
+                    if (boxes[items[k]].overlaps(box)) out.push_back(items[k]);
+                continue;
+            }
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+        std::sort(out.begin(), out.end());
+    }
+
+private:
+    void fit(int k) {
+        bvh_node_t& node = nodes[k];
+        node.box = aabb_t();
+        if (node.count > 0)
+            for (int j = node.first; j < node.first + node.count; ++j) node.box.add(boxes[items[j]]);
+        else {
+            node.box.add(nodes[node.first].box);
+            node.box.add(nodes[node.first + 1].box);
+        }
+    }
+
+    // makes node k cover items [begin, end). Median splits keep the depth at
+    // log2(n / BVH_LEAF_SIZE), well inside the fixed traversal stacks.
+    void split(int k, int begin, int end) {
+        if (end - begin <= BVH_LEAF_SIZE) {
+            nodes[k].first = begin;
+            nodes[k].count = end - begin;
+            for (int j = begin; j < end; ++j) leaf_of[items[j]] = k;
+            fit(k);
+            return;
+        }
+
+        aabb_t centres;
+        for (int j = begin; j < end; ++j) {
+            vec2 c = boxes[items[j]].centre();
+            centres.add({c, c});
+        }
+        bool along_x = centres.hi.x - centres.lo.x >= centres.hi.y - centres.lo.y;
+        int  mid = begin + (end - begin) / 2;
+        std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [&](int a, int b) {
+            vec2 ca = boxes[a].centre(), cb = boxes[b].centre();
+            return along_x ? ca.x < cb.x : ca.y < cb.y;
+        });
+
+        int child = static_cast<int>(nodes.size());
+        nodes[k].first = child;
+        nodes[k].count = 0;
+        nodes.push_back(bvh_node_t());
+        nodes.push_back(bvh_node_t());
+        nodes[child].parent = nodes[child + 1].parent = k;
+        split(child, begin, mid);
+        split(child + 1, mid, end);
+        fit(k);
+    }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef CASCADE_BUFFER_H
+#define CASCADE_BUFFER_H
+
+#include <SDL3/SDL.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "color_format.hpp"
+
+// All cascade levels live in one aligned allocation. A level is ray_w x ray_h
+// rays stored x-major (x * h + y), either as interleaved RGBA (AoS) or as
+// four planes R, G, B, transmittance (SoA), in floats or halves (see
+// color_format.hpp). RGB9E5 levels are always two planes, the packed colours
+// and the transmittance bytes.
+// Code outside this file only sees levels through cascade_view_t.
+
+// CASCADE_SOA  - one plane per channel instead of interleaved RGBA. A build
+//                flag rather than a setting, so at()/set() stay branch free.
+// #define CASCADE_SOA
+
+inline const char* layout_name() {
+#ifdef CASCADE_SOA
+    return "SoA";
+#else
+    return "AoS";
+#endif
+}
+
+// bytes one ray takes in a format
+inline size_t cascade_ray_bytes(int format) {
+    return format == COLOR_F16 ? 8 : format == COLOR_RGB9E5 ? 5 : 16;
+}
+
+// One level of the arena. at()/set() go by the format the level was
+// allocated with; hot loops that know it call get<F>()/put<F>() instead.
+struct cascade_view_t {
+    unsigned char* base = nullptr;
+    int    w = 0, h = 0;
+    size_t plane = 0;           // rays between SoA planes
+    int    format = COLOR_F32;
+
+    SDL_FColor at(int x, int y) const {
+        switch (format) {
+            case COLOR_F16:    return get<COLOR_F16>(x, y);
+            case COLOR_RGB9E5: return get<COLOR_RGB9E5>(x, y);
+            default:           return get<COLOR_F32>(x, y);
+        }
+    }
+
+    void set(int x, int y, SDL_FColor v) const {
+        switch (format) {
+            case COLOR_F16:    put<COLOR_F16>(x, y, v); break;
+            case COLOR_RGB9E5: put<COLOR_RGB9E5>(x, y, v); break;
+            default:           put<COLOR_F32>(x, y, v);
+        }
+    }
+
+    template <int F>
+    SDL_FColor get(int x, int y) const {
+        size_t i = static_cast<size_t>(x) * h + y;
+        if (F == COLOR_F16) {
+            const uint16_t* p = reinterpret_cast<const uint16_t*>(base);
+#ifdef CASCADE_SOA
+            uint16_t c[4] = {p[i], p[plane + i], p[2 * plane + i], p[3 * plane + i]};
+            return half_to_color(c);
+#else
+            return half_to_color(p + 4 * i);
+#endif
+        }
+        if (F == COLOR_RGB9E5) {
+            SDL_FColor c;
+            rgb9e5_to_rgb(reinterpret_cast<const uint32_t*>(base)[i], &c.r);
+            c.a = from_unorm8(base[4 * plane + i]);
+            return c;
+        }
+        const float* p = reinterpret_cast<const float*>(base);
+#ifdef CASCADE_SOA
+        return {p[i], p[plane + i], p[2 * plane + i], p[3 * plane + i]};
+#else
+        const float* c = p + 4 * i;
+        return {c[0], c[1], c[2], c[3]};
+#endif
+    }
+
+    template <int F>
+    void put(int x, int y, SDL_FColor v) const {
+        size_t i = static_cast<size_t>(x) * h + y;
+        if (F == COLOR_F16) {
+            uint16_t* p = reinterpret_cast<uint16_t*>(base);
+#ifdef CASCADE_SOA
+            uint16_t c[4];
+            color_to_half(v, c);
+            p[i] = c[0]; p[plane + i] = c[1]; p[2 * plane + i] = c[2]; p[3 * plane + i] = c[3];
+#else
+            color_to_half(v, p + 4 * i);
+#endif
+            return;
+        }
+        if (F == COLOR_RGB9E5) {
+            reinterpret_cast<uint32_t*>(base)[i] = color_to_rgb9e5(v);
+            base[4 * plane + i] = unorm8(v.a);
+            return;
+        }
+        float* p = reinterpret_cast<float*>(base);
+#ifdef CASCADE_SOA
+        p[i] = v.r; p[plane + i] = v.g; p[2 * plane + i] = v.b; p[3 * plane + i] = v.a;
+#else
+        float* c = p + 4 * i;
+        c[0] = v.r; c[1] = v.g; c[2] = v.b; c[3] = v.a;
+#endif
+    }
+};
+
+class cascade_arena_t {
+public:
+    cascade_arena_t() {}
+    ~cascade_arena_t() { release(); }
+
+    cascade_arena_t(const cascade_arena_t&) = delete;
+    cascade_arena_t& operator=(const cascade_arena_t&) = delete;
+
+    // levels of w x h rays, every level and plane starting on a cache line
+    bool alloc(int _levels, int _w, int _h, int _format = COLOR_F32) {
+        release();
+        levels = _levels; w = _w; h = _h; format = _format;
+        plane = (static_cast<size_t>(w) * h + 63) & ~static_cast<size_t>(63);
+        if (levels <= 0) return true;
+
+        data = static_cast<unsigned char*>(SDL_aligned_alloc(64, bytes()));
+        if (!data) {
+            levels = 0;
+            return false;
+        }
+        for (int Cn = 0; Cn < levels; ++Cn) clear(Cn, {0.0f, 0.0f, 0.0f, 1.0f});
+        return true;
+    }
+
+    void release() {
+        if (data) SDL_aligned_free(data);
+        data = nullptr;
+        levels = 0;
+    }
+
+    void clear(int Cn, SDL_FColor v) {
+        cascade_view_t lv = level(Cn);
+        for (int x = 0; x < w; ++x)
+            for (int y = 0; y < h; ++y) lv.set(x, y, v);
+    }
+
+    cascade_view_t level(int Cn) const {
+        return {data + Cn * plane * cascade_ray_bytes(format), w, h, plane, format};
+    }
+
+    int    count() const { return levels; }
+    int    color_format() const { return format; }
+    size_t bytes() const { return static_cast<size_t>(levels) * plane * cascade_ray_bytes(format); }
+
+private:
+    unsigned char* data = nullptr;
+    int    levels = 0, w = 0, h = 0, format = COLOR_F32;
+    size_t plane = 0;
+};
+
+#endif
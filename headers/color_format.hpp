@@ -0,0 +1,244 @@
+#ifndef COLOR_FORMAT_H
+#define COLOR_FORMAT_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Storage formats for the cascades and buf_light. Both are read and written a
+// ray/pixel at a time by passes that mostly move memory, so a smaller element
+// is a direct bandwidth saving, paid for with rounding:
+// COLOR_F32    - 4 floats, 16 bytes, exact
+// COLOR_F16    - 4 halves, 8 bytes, 11 significant bits per channel
+// COLOR_RGB9E5 - 9 bit mantissas sharing a 5 bit exponent (4 bytes) and the
+//                transmittance as an 8 bit fraction, 5 bytes. Channels much
+//                darker than the brightest one of a ray lose most of their bits.
+enum color_formats {
+    COLOR_F32,
+    COLOR_F16,
+    COLOR_RGB9E5
+};
+
+inline const char* color_format_name(int format) {
+    switch (format) {
+        case COLOR_F16:    return "FP16";
+        case COLOR_RGB9E5: return "RGB9E5";
+        default:           return "FP32";
+    }
+}
+
+// "f16" or "rgb9e5", anything else is FP32
+inline int parse_color_format(const char* s) {
+    if (!strcmp(s, "f16"))    return COLOR_F16;
+    if (!strcmp(s, "rgb9e5")) return COLOR_RGB9E5;
+    return COLOR_F32;
+}
+
+// Half floats, round to nearest even, all four channels of a colour at once.
+// F16C does it in one instruction; the SSE2 version does the same with
+// integer ops on the bit patterns (overflow gives inf, NaN stays NaN).
+inline void color_to_half(const SDL_FColor& c, uint16_t* h) {
+#if defined(__F16C__)
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(h), _mm_cvtps_ph(_mm_loadu_ps(&c.r), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(__SSE2__)
+    __m128  f    = _mm_loadu_ps(&c.r);
+    __m128  sign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(0x80000000u))));
+    __m128  absf = _mm_xor_ps(f, sign);
+    __m128i bits = _mm_castps_si128(absf);
+    // inf/NaN above the largest half, subnormals below the smallest normal one
+    __m128i regular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), bits);
+    __m128i special = _mm_or_si128(_mm_set1_epi32(0x7c00),
+                                   _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200)));
+    __m128i is_sub  = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), bits);
+    // subnormal: adding a magic value rounds the mantissa in place
+    __m128i magic   = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    __m128i sub     = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(magic))), magic);
+    // normal: rebias the exponent, round half to even on the dropped 13 bits
+    __m128i odd     = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);
+    __m128i normal  = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(bits, _mm_set1_epi32(0xfff - ((127 - 15) << 23))), odd), 13);
+    __m128i v = _mm_or_si128(_mm_and_si128(is_sub, sub), _mm_andnot_si128(is_sub, normal));
+    v = _mm_or_si128(_mm_and_si128(regular, v), _mm_andnot_si128(regular, special));
+    // the sign comes in sign extended, so the signed pack keeps every pattern
+    v = _mm_or_si128(v, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(h), _mm_packs_epi32(v, v));
+#else
+    const float* f = &c.r;
+    for (int k = 0; k < 4; ++k) {
+        uint32_t x;
+        memcpy(&x, &f[k], 4);
+        uint32_t sign = x & 0x80000000u;
+        x ^= sign;
+        uint16_t o;
+        if (x >= (127u + 16) << 23)
+            o = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+        else if (x < (127u - 14) << 23) {
+            float a, magic;
+            uint32_t m = ((127u - 15) + (23 - 10) + 1) << 23;
+            memcpy(&a, &x, 4);
+            memcpy(&magic, &m, 4);
+            a += magic;
+            memcpy(&x, &a, 4);
+            o = static_cast<uint16_t>(x - m);
+        }
+        else {
+            uint32_t odd = (x >> 13) & 1;
+            o = static_cast<uint16_t>((x + 0xfff - ((127u - 15) << 23) + odd) >> 13);
+        }
+        h[k] = static_cast<uint16_t>(o | (sign >> 16));
+    }
+#endif
+}
+
+inline SDL_FColor half_to_color(const uint16_t* h) {
+    SDL_FColor c;
+#if defined(__F16C__)
+    _mm_storeu_ps(&c.r, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(h))));
+#elif defined(__SSE2__)
+    __m128i v    = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(h)), _mm_setzero_si128());
+    __m128i em   = _mm_and_si128(v, _mm_set1_epi32(0x7fff));
+    __m128i sign = _mm_slli_epi32(_mm_xor_si128(v, em), 16);
+    // moving exponent and mantissa into place and scaling by 2^112 handles
+    // normals and subnormals alike; inf/NaN get the full exponent back
+    __m128  f    = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(em, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+    __m128i inf  = _mm_and_si128(_mm_cmpgt_epi32(em, _mm_set1_epi32(0x7bff)), _mm_set1_epi32(255 << 23));
+    _mm_storeu_ps(&c.r, _mm_or_ps(f, _mm_castsi128_ps(_mm_or_si128(sign, inf))));
+#else
+    float* f = &c.r;
+    for (int k = 0; k < 4; ++k) {
+        uint32_t em = h[k] & 0x7fffu, x = em << 13, m = (254u - 15) << 23;
+        float v, scale;
+        memcpy(&v, &x, 4);
+        memcpy(&scale, &m, 4);
+        v *= scale;
+        memcpy(&x, &v, 4);
+        if (em > 0x7bff) x |= 255u << 23;
+        x |= static_cast<uint32_t>(h[k] & 0x8000u) << 16;
+        memcpy(&f[k], &x, 4);
+    }
+#endif
+    return c;
+}
+
+// 2^e for -126 <= e <= 127, built from the bits
+inline float exp2_int(int e) {
+    uint32_t x = static_cast<uint32_t>(e + 127) << 23;
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+// Shared exponent RGB, the layout of EXT_texture_shared_exponent: r, g, b in
+// bits 0-8, 9-17, 18-26 and the exponent (bias 15) in 27-31. Negative values
+// become 0, values above 65408 saturate.
+inline uint32_t color_to_rgb9e5(const SDL_FColor& c) {
+    const float max_value = 65408.0f;
+    float r = std::min(std::max(c.r, 0.0f), max_value);
+    float g = std::min(std::max(c.g, 0.0f), max_value);
+    float b = std::min(std::max(c.b, 0.0f), max_value);
+    float m = std::max({r, g, b});
+    uint32_t bits;
+    memcpy(&bits, &m, 4);
+    // floor(log2(m)) straight from the exponent, 0 and tiny values at the bottom
+    int e = std::max(-16, static_cast<int>(bits >> 23) - 127) + 16;
+    float scale = exp2_int(24 - e);
+    if (static_cast<uint32_t>(m * scale + 0.5f) == 512) {
+        ++e;
+        scale *= 0.5f;
+    }
+    auto mant = [&](float v) { return static_cast<uint32_t>(v * scale + 0.5f); };
+    return mant(r) | mant(g) << 9 | mant(b) << 18 | static_cast<uint32_t>(e) << 27;
+}
+
+inline void rgb9e5_to_rgb(uint32_t v, float* rgb) {
+    float scale = exp2_int(static_cast<int>(v >> 27) - 24);
+    rgb[0] = static_cast<float>(v & 0x1ff) * scale;
+    rgb[1] = static_cast<float>((v >> 9) & 0x1ff) * scale;
+    rgb[2] = static_cast<float>((v >> 18) & 0x1ff) * scale;
+}
+
+// transmittance in [0, 1] as a byte; 0 and 1 stay exact, which the merge tests
+inline uint8_t unorm8(float v) {
+    return static_cast<uint8_t>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+inline float from_unorm8(uint8_t v) {
+    return v * (1.0f / 255.0f);
+}
+
+// A per-pixel colour buffer in one of the formats (buf_light). RGB9E5 keeps
+// no alpha here and reads back 1, everything else stores it.
+class color_buffer_t {
+public:
+    void assign(size_t n, int _format, SDL_FColor v) {
+        format = _format;
+        count  = n;
+        data.resize(n * stride());
+        for (size_t i = 0; i < n; ++i) set(i, v);
+    }
+
+    SDL_FColor at(size_t i) const {
+        const unsigned char* p = &data[i * stride()];
+        if (format == COLOR_F16) {
+            uint16_t h[4];
+            memcpy(h, p, 8);
+            return half_to_color(h);
+        }
+        if (format == COLOR_RGB9E5) {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            SDL_FColor c = {0.0f, 0.0f, 0.0f, 1.0f};
+            rgb9e5_to_rgb(v, &c.r);
+            return c;
+        }
+        SDL_FColor c;
+        memcpy(&c, p, 16);
+        return c;
+    }
+
+    void set(size_t i, const SDL_FColor& c) {
+        unsigned char* p = &data[i * stride()];
+        if (format == COLOR_F16) {
+            uint16_t h[4];
+            color_to_half(c, h);
+            memcpy(p, h, 8);
+        }
+        else if (format == COLOR_RGB9E5) {
+            uint32_t v = color_to_rgb9e5(c);
+            memcpy(p, &v, 4);
+        }
+        else
+            memcpy(p, &c, 16);
+    }
+
+    // n consecutive elements from i on, the format picked once
+    void set(size_t i, const SDL_FColor* c, size_t n) {
+        unsigned char* p = &data[i * stride()];
+        if (format == COLOR_F16)
+            for (size_t k = 0; k < n; ++k) color_to_half(c[k], reinterpret_cast<uint16_t*>(p + k * 8));
+        else if (format == COLOR_RGB9E5)
+            for (size_t k = 0; k < n; ++k) {
+                uint32_t v = color_to_rgb9e5(c[k]);
+                memcpy(p + k * 4, &v, 4);
+            }
+        else
+            memcpy(p, c, n * 16);
+    }
+
+    size_t size() const { return count; }
+    size_t bytes() const { return data.size(); }
+    int    color_format() const { return format; }
+
+private:
+    size_t stride() const { return format == COLOR_F16 ? 8 : format == COLOR_RGB9E5 ? 4 : 16; }
+
+    std::vector<unsigned char> data;
+    size_t count = 0;
+    int    format = COLOR_F32;
+};
+
+#endif
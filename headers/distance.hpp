@@ -0,0 +1,96 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include <cmath>
+#include "geometry.hpp"
+
+// DIST_EDT      - exact euclidean distance transform of the rasterised buf_obj, O(W*H)
+// DIST_ANALYTIC - reference mode, min of Object::sdf() over all objects, O(W*H*N)
+enum dist_modes {
+    DIST_EDT,
+    DIST_ANALYTIC
+};
+
+const float EDT_INF = 1e20f;
+
+// 1D squared distance transform of a sampled function (Felzenszwalb & Huttenlocher).
+// Only finite samples of f act as parabola sites, so an empty line stays at EDT_INF.
+// v and z are scratch of at least n and n+1 elements.
+inline void edt_1d(const float* f, float* d, int n, int* v, float* z) {
+    int k = -1;
+    for (int q = 0; q < n; ++q) {
+        if (f[q] >= EDT_INF) continue;
+        if (k < 0) {
+            k = 0;
+            v[0] = q;
+            z[0] = -EDT_INF;
+            z[1] = EDT_INF;
+            continue;
+        }
+        float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * (q - v[k]));
+        while (s <= z[k]) {
+            --k;
+            s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * (q - v[k]));
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = EDT_INF;
+    }
+
+    if (k < 0) {
+        for (int q = 0; q < n; ++q) d[q] = EDT_INF;
+        return;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) ++k;
+        float dq = static_cast<float>(q - v[k]);
+        d[q] = dq * dq + f[v[k]];
+    }
+}
+
+// Exact euclidean distance from every pixel to the nearest occupied pixel of occ
+// (a pixel is occupied when something was drawn into it, i.e. color.a != 0).
+// Separable: one pass down the columns, one across the rows. Cost does not depend
+// on how many objects were rasterised. occ and dist are laid out as pixel_index()
+// says, the column results in between are plain x-major (x * h + y).
+//
+// The passes are split so callers can run them in bands and redo only the
+// columns whose occupancy changed; the rows always have to be redone.
+// v and z are scratch of at least max(w, h) and max(w, h) + 1 elements.
+
+// columns [x0, x1): squared distance along y into cols
+inline void edt_columns(const material_t* occ, float* cols, int h, int x0, int x1, float* f, int* v, float* z) {
+    for (int x = x0; x < x1; ++x) {
+        for (int y = 0; y < h; ++y)
+            f[y] = occ[pixel_index(x, y, h)].color.a != 0 ? 0.0f : EDT_INF;
+        edt_1d(f, cols + x * h, h, v, z);
+    }
+}
+
+const int EDT_ROW_BLOCK = 16;
+
+// rows [y0, y1): combines the column results along x.
+// Rows go EDT_ROW_BLOCK at a time, so reading and writing the x-major buffers
+// touches whole runs of y instead of one float per column.
+// f and d are scratch of at least EDT_ROW_BLOCK * w elements.
+inline void edt_rows(const float* cols, float* dist, int w, int h, int y0, int y1, float max_dist,
+                     float* f, float* d, int* v, float* z) {
+    for (int yb = y0; yb < y1; yb += EDT_ROW_BLOCK) {
+        int n = y1 - yb < EDT_ROW_BLOCK ? y1 - yb : EDT_ROW_BLOCK;
+        for (int x = 0; x < w; ++x)
+            for (int k = 0; k < n; ++k) f[k * w + x] = cols[x * h + yb + k];
+        for (int k = 0; k < n; ++k)
+            edt_1d(f + k * w, d + k * w, w, v, z);
+        for (int x = 0; x < w; ++x)
+            for (int k = 0; k < n; ++k) {
+                float dk = d[k * w + x];
+                float dd = dk >= EDT_INF ? max_dist : std::sqrt(dk);
+                dist[pixel_index(x, yb + k, h)] = dd < max_dist ? dd : max_dist;
+            }
+    }
+}
+
+#endif
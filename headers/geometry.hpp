@@ -46,6 +46,54 @@ inline float dot(vec2 a, vec2 b) {
     return a.x * b.x + a.y * b.y;
 }
 
+// pixel rectangle [x0, x1) x [y0, y1)
+struct rect_t {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+    long area()  const { return empty() ? 0 : static_cast<long>(x1 - x0) * (y1 - y0); }
+
+    rect_t expand(int m) const { return {x0 - m, y0 - m, x1 + m, y1 + m}; }
+    rect_t clip(const rect_t& o) const {
+        return {std::max(x0, o.x0), std::max(y0, o.y0), std::min(x1, o.x1), std::min(y1, o.y1)};
+    }
+    // grows to the bounding box of both, an empty rect adds nothing
+    void add(const rect_t& o) {
+        if (o.empty()) return;
+        if (empty()) { *this = o; return; }
+        x0 = std::min(x0, o.x0); y0 = std::min(y0, o.y0);
+        x1 = std::max(x1, o.x1); y1 = std::max(y1, o.y1);
+    }
+    bool operator==(const rect_t& o) const { return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1; }
+};
+
+// axis aligned box [lo, hi] in continuous coordinates
+struct aabb_t {
+    vec2 lo, hi;
+
+    aabb_t() : lo(INFINITY), hi(-INFINITY) {}
+    aabb_t(vec2 _lo, vec2 _hi) : lo(_lo), hi(_hi) {}
+    explicit aabb_t(const rect_t& r) : lo(r.x0, r.y0), hi(r.x1, r.y1) {}
+
+    void add(const aabb_t& o) {
+        lo = vec2(std::min(lo.x, o.lo.x), std::min(lo.y, o.lo.y));
+        hi = vec2(std::max(hi.x, o.hi.x), std::max(hi.y, o.hi.y));
+    }
+    vec2 centre() const { return (lo + hi) * 0.5f; }
+    bool contains(vec2 p) const { return p >= lo && p <= hi; }
+    bool overlaps(const aabb_t& o) const { return lo <= o.hi && o.lo <= hi; }
+    // squared distance from p to the box, 0 inside
+    float dist_sq(vec2 p) const {
+        float dx = std::max(std::max(lo.x - p.x, p.x - hi.x), 0.0f);
+        float dy = std::max(std::max(lo.y - p.y, p.y - hi.y), 0.0f);
+        return dx * dx + dy * dy;
+    }
+    // the pixels draw_object() walks, truncated like every shape always was
+    rect_t pixels() const {
+        return {static_cast<int>(lo.x), static_cast<int>(lo.y), static_cast<int>(hi.x), static_cast<int>(hi.y)};
+    }
+};
+
 struct ClosestObjectInfo {
     bool hasObject = false;
     int objectID = -1;
@@ -54,6 +102,60 @@ struct ClosestObjectInfo {
 
 
 
+// Per-pixel buffers (buf_obj, buf_dist, buf_light) go through pixel_index().
+// PIXEL_TILED - 8x8 tiles, x-major from tile to tile and inside each, so a
+//               ray in any direction stays on a few cache lines and pages
+//               for longer. Tiled buffers are padded to whole tiles. A build
+//               flag like CASCADE_SOA, so the index stays branch free; build
+//               with -DPIXEL_X_MAJOR for plain x-major buffers (x * h + y).
+#ifndef PIXEL_X_MAJOR
+#define PIXEL_TILED
+#endif
+const int PIXEL_TILE_LOG2 = 3;
+// largest side a pixel buffer may have, so pixel_index() fits an int
+const int PIXEL_MAX_SIZE = 1 << 15;
+
+// a side of n pixels as stored, whole tiles when tiled
+inline int pixel_pad(int n) {
+#ifdef PIXEL_TILED
+    return (n + (1 << PIXEL_TILE_LOG2) - 1) & ~((1 << PIXEL_TILE_LOG2) - 1);
+#else
+    return n;
+#endif
+}
+
+inline size_t pixel_count(int w, int h) {
+    return static_cast<size_t>(pixel_pad(w)) * pixel_pad(h);
+}
+
+// elements from one column to the next, or from one column of tiles to the
+// next when tiled
+inline int pixel_stride(int h) {
+#ifdef PIXEL_TILED
+    return pixel_pad(h) << PIXEL_TILE_LOG2;
+#else
+    return h;
+#endif
+}
+
+// element of pixel (x, y) in a buffer for h pixels high
+inline int pixel_index(int x, int y, int h) {
+#ifdef PIXEL_TILED
+    const int s = PIXEL_TILE_LOG2, m = (1 << s) - 1;
+    return (x >> s) * pixel_stride(h) + ((y >> s) << (2 * s)) + ((x & m) << s) + (y & m);
+#else
+    return x * h + y;
+#endif
+}
+
+inline const char* pixel_layout_name() {
+#ifdef PIXEL_TILED
+    return "8x8 tiled";
+#else
+    return "x-major";
+#endif
+}
+
 struct material_t {
     SDL_FColor color;
     float emissivity;      // 0.0 - 1.0
@@ -85,9 +187,14 @@ public:
 
     virtual ~Object() = default;
 
+    // signed euclidean distance, never below the distance to aabb()
     virtual float sdf(vec2 point) = 0;
 
-    virtual void draw(material_t* buf, int scr_w, int scr_h) = 0;
+    // box around everything with sdf() <= 0
+    virtual aabb_t aabb() = 0;
+
+    // pixels draw_object() may touch, before clipping to the screen
+    rect_t bounds() { return aabb().pixels(); }
 
     virtual vec2 get_normal(vec2 incident) {
         // Numerical gradient calculation as a default
@@ -111,23 +218,8 @@ public:
         return (point - centre).length() - radius;
     }
 
-    void draw(material_t* buf, int scr_w, int scr_h) override {
-        int x_start = static_cast<int>(centre.x - radius);
-        x_start = x_start < 0 ? 0 : x_start;
-        int x_end = static_cast<int>(centre.x + radius);
-        x_end = x_end > scr_w ? scr_w : x_end;
-        int y_start = static_cast<int>(centre.y - radius);
-        y_start = y_start < 0 ? 0 : y_start;
-        int y_end = static_cast<int>(centre.y + radius);
-        y_end = y_end > scr_h ? scr_h : y_end;
-
-        for (int x = x_start; x < x_end; ++x) {
-            for (int y = y_start; y < y_end; ++y) {
-                if (this->sdf(vec2(static_cast<float>(x), static_cast<float>(y))) <= 0) {
-                    *(buf + x * scr_h + y) = this->material;
-                }
-            }
-        }
+    aabb_t aabb() override {
+        return {centre - vec2(radius), centre + vec2(radius)};
     }
 };
 
@@ -144,23 +236,8 @@ public:
         return (vec2(std::max(d.x, 0.0f), std::max(d.y, 0.0f))).length() + std::min(std::max(d.x, d.y), 0.0f);
     }
 
-    void draw(material_t* buf, int scr_w, int scr_h) override {
-        int x_start = static_cast<int>(centre.x - size.x);
-        x_start = x_start < 0 ? 0 : x_start;
-        int x_end = static_cast<int>(centre.x + size.x);
-        x_end = x_end > scr_w ? scr_w : x_end;
-        int y_start = static_cast<int>(centre.y - size.y);
-        y_start = y_start < 0 ? 0 : y_start;
-        int y_end = static_cast<int>(centre.y + size.y);
-        y_end = y_end > scr_h ? scr_h : y_end;
-
-        for (int x = x_start; x < x_end; ++x) {
-            for (int y = y_start; y < y_end; ++y) {
-                if (this->sdf(vec2(static_cast<float>(x), static_cast<float>(y))) <= 0) {
-                    *(buf + x * scr_h + y) = this->material;
-                }
-            }
-        }
+    aabb_t aabb() override {
+        return {centre - size, centre + size};
     }
 };
 
@@ -181,28 +258,14 @@ public:
         vec2 pq2 = v2 - e2 * std::max(0.0f, std::min(1.0f, dot(v2, e2) / dot(e2, e2)));
 
         float s = e0.x * e2.y - e0.y * e2.x;
-        float d = std::min(std::min(dot(pq0, pq0), dot(pq1, pq1)), dot(pq2, pq2));
+        float d = std::sqrt(std::min(std::min(dot(pq0, pq0), dot(pq1, pq1)), dot(pq2, pq2)));
 
         return d * (s * (v0.x * e2.y - v0.y * e2.x) > 0.0f ? 1.0f : -1.0f);
     }
 
-    void draw(material_t* buf, int scr_w, int scr_h) override {
-        int x_start = static_cast<int>(std::min({p0.x, p1.x, p2.x}));
-        x_start = x_start < 0 ? 0 : x_start;
-        int x_end = static_cast<int>(std::max({p0.x, p1.x, p2.x}));
-        x_end = x_end > scr_w ? scr_w : x_end;
-        int y_start = static_cast<int>(std::min({p0.y, p1.y, p2.y}));
-        y_start = y_start < 0 ? 0 : y_start;
-        int y_end = static_cast<int>(std::max({p0.y, p1.y, p2.y}));
-        y_end = y_end > scr_h ? scr_h : y_end;
-
-        for (int x = x_start; x < x_end; ++x) {
-            for (int y = y_start; y < y_end; ++y) {
-                if (this->sdf(vec2(static_cast<float>(x), static_cast<float>(y))) <= 0) {
-                    *(buf + x * scr_h + y) = this->material;
-                }
-            }
-        }
+    aabb_t aabb() override {
+        return {vec2(std::min({p0.x, p1.x, p2.x}), std::min({p0.y, p1.y, p2.y})),
+                vec2(std::max({p0.x, p1.x, p2.x}), std::max({p0.y, p1.y, p2.y}))};
     }
 };
 
@@ -221,23 +284,9 @@ public:
         return (pa - ba * h).length() - thickness;
     }
 
-    void draw(material_t* buf, int scr_w, int scr_h) override {
-        int x_start = static_cast<int>(std::min(start.x, end.x) - thickness);
-        x_start = x_start < 0 ? 0 : x_start;
-        int x_end = static_cast<int>(std::max(start.x, end.x) + thickness);
-        x_end = x_end > scr_w ? scr_w : x_end;
-        int y_start = static_cast<int>(std::min(start.y, end.y) - thickness);
-        y_start = y_start < 0 ? 0 : y_start;
-        int y_end = static_cast<int>(std::max(start.y, end.y) + thickness);
-        y_end = y_end > scr_h ? scr_h : y_end;
-
-        for (int x = x_start; x < x_end; ++x) {
-            for (int y = y_start; y < y_end; ++y) {
-                if (this->sdf(vec2(static_cast<float>(x), static_cast<float>(y))) <= 0) {
-                    *(buf + x * scr_h + y) = this->material;
-                }
-            }
-        }
+    aabb_t aabb() override {
+        return {vec2(std::min(start.x, end.x) - thickness, std::min(start.y, end.y) - thickness),
+                vec2(std::max(start.x, end.x) + thickness, std::max(start.y, end.y) + thickness)};
     }
 };
 
@@ -0,0 +1,350 @@
+#ifndef HRC_H
+#define HRC_H
+
+#include <SDL3/SDL.h>
+#include <cmath>
+#include <vector>
+#include "color_format.hpp"
+#include "geometry.hpp"
+#include "march.hpp"
+#include "thread_pool.hpp"
+
+// Holographic Radiance Cascades. The directions around a probe are split in
+// four 90 degree frusta (+x, +y, -x, -y), each solved as if it looked along +x
+// in its own (u, v) frame: u along the frustum axis, v across it.
+//
+// Level n has a probe on every row v and on every 2^n-th column u. Its rays
+// run from a probe (u, v) to (u + 2^n, v + o), o in [-2^n, 2^n], and carry
+// radiance and transmittance (a, 1 = nothing hit) like the RC cascades.
+// Only level 0 is marched. Every longer ray is extended from two rays of the
+// level below meeting at the probe half way, an odd offset averaging both
+// ways of splitting it.
+//
+// Level n has 2^n cones per probe; cone k holds the rays crossing column
+// u + 2^n between rows v + 2k - 2^n and v + 2k + 2 - 2^n, so every cone of
+// level n is two cones of level n+1. The merge runs top down: each of those
+// two sub-cones is read off the rays through its window and continues with
+// the same cone of the level n+1 probes the rays end on. Odd probes find
+// those on column u + 2^n; even probes sit on a level n+1 column themselves
+// and reach the next one with the level n+1 rays. Sub-cones are weighted by
+// the angle they cover, the rays of a window with the trapezoid rule.
+//
+// Level 0 holds one cone per frustum; the average of the four is the fluence.
+// Nothing enters from outside the screen.
+
+struct hrc_frustum_t {
+    int dir;        // 0 +x, 1 +y, 2 -x, 3 -y
+    int U, V;       // probes along and across the frustum
+
+    // probe grid position of (u, v)
+    int gx(int u, int v) const { return dir == 0 ? u : dir == 2 ? U - 1 - u : v; }
+    int gy(int u, int v) const { return dir == 1 ? u : dir == 3 ? U - 1 - u : v; }
+    // screen direction of the frame vector (du, dv)
+    vec2 world(float du, float dv) const {
+        switch (dir) {
+            case 0:  return vec2(du, dv);
+            case 1:  return vec2(dv, du);
+            case 2:  return vec2(-du, dv);
+            default: return vec2(dv, -du);
+        }
+    }
+};
+
+struct hrc_solver_t {
+    int spacing = 1;                // pixels between probes
+    int gw = 0, gh = 0;             // probe grid, probe (i, j) sits on pixel (i, j) * spacing
+    std::vector<std::vector<SDL_FColor>> rays;  // rays[n] of the frustum being solved
+    std::vector<SDL_FColor> cones, cones_up;    // merged cones of level n and n+1
+    std::vector<SDL_FColor> fluence;            // gw x gh, x-major
+    std::vector<std::vector<float>> share;      // share[n][s]: sub-cone s of level n in its parent
+    int block = 32;                 // side of the probe blocks handed to the workers
+
+    // of the last solve(), ms per level (marching included in level 0)
+    std::vector<double> level_ms;
+    double merge_ms = 0;
+    long   traced = 0;              // rays marched
+
+    void init(int scr_w, int scr_h, int _spacing) {
+        spacing = _spacing;
+        gw = (scr_w + spacing - 1) / spacing;
+        gh = (scr_h + spacing - 1) / spacing;
+        int top = levels(std::max(gw, gh));
+        rays.assign(top + 1, std::vector<SDL_FColor>());
+        share.assign(top + 1, std::vector<float>());
+        for (int n = 1; n <= top; ++n) {
+            // cone s of level n covers slopes [s - 2^(n-1), s + 1 - 2^(n-1)] / 2^(n-1)
+            float h = static_cast<float>(1 << (n - 1));
+            for (int s = 0; s < (1 << n); ++s) share[n].push_back(std::atan((s + 1 - h) / h) - std::atan((s - h) / h));
+            for (int s = 0; s < (1 << n); s += 2) {
+                float sum = share[n][s] + share[n][s + 1];
+                share[n][s] /= sum;
+                share[n][s + 1] /= sum;
+            }
+        }
+        fluence.assign(static_cast<size_t>(gw) * gh, {0, 0, 0, 1});
+        level_ms.assign(top + 1, 0.0);
+    }
+
+    void release() {
+        rays.clear();
+        cones.clear();
+        cones_up.clear();
+        fluence.clear();
+        share.clear();
+        gw = gh = 0;
+    }
+
+    // smallest top level whose rays span n probes
+    static int levels(int n) {
+        int top = 1;
+        while ((1 << top) < n) ++top;
+        return top;
+    }
+
+    // Solves all four frusta over the field and writes the interpolated
+    // fluence into light (field.w x field.h, see pixel_index()).
+    void solve(thread_pool& pool, int tile_size, const march_field_t& field, int simd, color_buffer_t& light) {
+        block = tile_size;
+        std::fill(level_ms.begin(), level_ms.end(), 0.0);
+        merge_ms = 0;
+        traced   = 0;
+        std::fill(fluence.begin(), fluence.end(), SDL_FColor{0, 0, 0, 1});
+        for (int dir = 0; dir < 4; ++dir) {
+            hrc_frustum_t f = {dir, dir % 2 ? gh : gw, dir % 2 ? gw : gh};
+            int top = levels(f.U);
+            Uint64 t0 = SDL_GetPerformanceCounter();
+            trace(pool, field, simd, f);
+            level_ms[0] += ms(t0);
+            for (int n = 0; n < top; ++n) {
+                t0 = SDL_GetPerformanceCounter();
+                extend(pool, f, n);
+                level_ms[n + 1] += ms(t0);
+            }
+            t0 = SDL_GetPerformanceCounter();
+            merge(pool, f, top);
+            merge_ms += ms(t0);
+        }
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        gather(pool, field.w, field.h, light);
+        merge_ms += ms(t0);
+    }
+
+private:
+    static double ms(Uint64 start) {
+        return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    }
+
+    static int probes(const hrc_frustum_t& f, int n) { return (f.U - 1) / (1 << n) + 1; }
+    static int width(int n) { return (2 << n) + 1; }    // rays per probe
+
+    // Ray o of probe i (column i * 2^n) on row v, and cone k of it. Rows are
+    // innermost: the loops run down v, and the probes a ray ends on are then
+    // consecutive as well.
+    static size_t ray(const hrc_frustum_t& f, int n, int i, int v, int o) {
+        return (static_cast<size_t>(i) * width(n) + o + (1 << n)) * f.V + v;
+    }
+    static size_t cone(const hrc_frustum_t& f, int n, int i, int v, int k) {
+        return ((static_cast<size_t>(i) << n) + k) * f.V + v;
+    }
+
+    // level 0: three rays per probe, marched through the distance field
+    void trace(thread_pool& pool, const march_field_t& field, int simd, const hrc_frustum_t& f) {
+        rays[0].resize(static_cast<size_t>(f.U) * f.V * width(0));
+        const float len[2] = {static_cast<float>(spacing), spacing * std::sqrt(2.0f)};
+        vec2 dirs[3];
+        for (int o = -1; o <= 1; ++o) dirs[o + 1] = f.world(1.0f, static_cast<float>(o)).norm();
+
+        pool.parallel_for(tile_count(f.U, f.V, block), [&](int t, int) {
+            tile_t tile = tile_rect(t, f.U, f.V, block);
+            thread_local std::vector<float> ox, oy, dx, dy;
+            thread_local std::vector<SDL_FColor> out;
+            thread_local std::vector<size_t> at;
+            size_t cap = static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 2;
+            ox.resize(cap); oy.resize(cap); dx.resize(cap); dy.resize(cap); out.resize(cap); at.resize(cap);
+
+            // straight rays, then the diagonal ones, each batch sharing a length
+            for (int diag = 0; diag < 2; ++diag) {
+                int n = 0;
+                for (int u = tile.x0; u < tile.x1; ++u)
+                    for (int o = -diag; o <= diag; o += 2)
+                        for (int v = tile.y0; v < tile.y1; ++v) {
+                            ox[n] = static_cast<float>(f.gx(u, v) * spacing);
+                            oy[n] = static_cast<float>(f.gy(u, v) * spacing);
+                            dx[n] = dirs[o + 1].x;
+                            dy[n] = dirs[o + 1].y;
+                            at[n++] = ray(f, 0, u, v, o);
+                        }
+                march_rays(simd, field, ox.data(), oy.data(), dx.data(), dy.data(), len[diag], n, out.data());
+                for (int k = 0; k < n; ++k) rays[0][at[k]] = out[k];
+            }
+        });
+        traced += static_cast<long>(f.U) * f.V * width(0);
+    }
+
+    // level n+1 from level n: ray (i, v, o) of n+1 is ray (2i, v, a) of n
+    // followed by ray (2i + 1, v + a, o - a), a = o / 2 rounded both ways
+    void extend(thread_pool& pool, const hrc_frustum_t& f, int n) {
+        int m = n + 1, half = 1 << n;
+        int lo_probes = probes(f, n), up_probes = probes(f, m);
+        rays[m].resize(static_cast<size_t>(up_probes) * f.V * width(m));
+        const std::vector<SDL_FColor>& lo = rays[n];
+        std::vector<SDL_FColor>& up = rays[m];
+
+        pool.parallel_for(tile_count(up_probes, f.V, block), [&](int t, int) {
+            tile_t tile = tile_rect(t, up_probes, f.V, block);
+            // adds w * (ray a of 2i then ray b of 2i + 1) to rows [y0, y1) of out
+            auto part = [&](int i, int a, int b, float w, SDL_FColor* out) {
+                const SDL_FColor* near = &lo[ray(f, n, 2 * i, 0, a)];
+                bool has_far = 2 * i + 1 < lo_probes;
+                const SDL_FColor* far = has_far ? &lo[ray(f, n, 2 * i + 1, 0, b)] : nullptr;
+                // rows whose midpoint is on the screen, past it nothing follows
+                int v0 = has_far ? std::max(tile.y0, -a) : tile.y1, v1 = has_far ? std::min(tile.y1, f.V - a) : tile.y1;
+                v0 = std::min(v0, tile.y1);
+                v1 = std::max(v1, v0);
+                auto add = [&](int v, const SDL_FColor& r) {
+                    SDL_FColor& o = out[v - tile.y0];
+                    o.r += w * r.r; o.g += w * r.g; o.b += w * r.b; o.a += w * r.a;
+                };
+                for (int v = tile.y0; v < v0; ++v) add(v, near[v]);
+                for (int v = v0; v < v1; ++v) {
+                    // near then far: rgb + a * far.rgb, a * far.a, written alike
+                    // for all four channels so that they go as one vector
+                    SDL_FColor x = near[v], y = far[v + a];
+                    float t = w * x.a;
+                    SDL_FColor& o = out[v - tile.y0];
+                    o.r += w * x.r + t * y.r; o.g += w * x.g + t * y.g;
+                    o.b += w * x.b + t * y.b; o.a += w * x.a + t * (y.a - 1);
+                }
+                for (int v = v1; v < tile.y1; ++v) add(v, near[v]);
+            };
+            thread_local std::vector<SDL_FColor> acc;
+            acc.resize(tile.y1 - tile.y0);
+            for (int i = tile.x0; i < tile.x1; ++i)
+                for (int o = -2 * half; o <= 2 * half; ++o) {
+                    int a = (o + 2 * half) / 2 - half;      // floor(o / 2)
+                    std::fill(acc.begin(), acc.end(), SDL_FColor{0, 0, 0, 0});
+                    if (o % 2 == 0) part(i, a, a, 1.0f, acc.data());
+                    else {
+                        part(i, a, a + 1, 0.5f, acc.data());
+                        part(i, a + 1, a, 0.5f, acc.data());
+                    }
+                    std::copy(acc.begin(), acc.end(), up.begin() + ray(f, m, i, tile.y0, o));
+                }
+        });
+    }
+
+    // cones from the top level down to level 0, which is added to the fluence
+    void merge(thread_pool& pool, const hrc_frustum_t& f, int top) {
+        const float tw[3] = {0.25f, 0.5f, 0.25f};
+
+        // the top level only sees its own rays
+        int np = probes(f, top);
+        cones_up.resize(static_cast<size_t>(np) * f.V << top);
+        pool.parallel_for(tile_count(np, f.V, block), [&](int t, int) {
+            tile_t tile = tile_rect(t, np, f.V, block);
+            for (int i = tile.x0; i < tile.x1; ++i)
+                for (int k = 0; k < (1 << top); ++k) {
+                    SDL_FColor* c = &cones_up[cone(f, top, i, 0, k)];
+                    for (int v = tile.y0; v < tile.y1; ++v) c[v] = {0, 0, 0, 1};
+                    for (int e = 0; e < 3; ++e) {
+                        const SDL_FColor* r = &rays[top][ray(f, top, i, 0, 2 * k - (1 << top) + e)];
+                        for (int v = tile.y0; v < tile.y1; ++v) {
+                            c[v].r += tw[e] * r[v].r; c[v].g += tw[e] * r[v].g; c[v].b += tw[e] * r[v].b;
+                        }
+                    }
+                }
+        });
+
+        for (int n = top - 1; n >= 0; --n) {
+            int m = n + 1, half = 1 << n;
+            int lo_probes = probes(f, n), up_probes = probes(f, m);
+            cones.resize(static_cast<size_t>(lo_probes) * f.V << n);
+
+            pool.parallel_for(tile_count(lo_probes, f.V, block), [&](int t, int) {
+                tile_t tile = tile_rect(t, lo_probes, f.V, block);
+                // adds w * (ray r continued by cone s of probe q of level n+1) to
+                // the rows [y0, y1) of out, the ray from row v ends on row v + o
+                auto through = [&](const SDL_FColor* r, int q, int o, int s, float w, SDL_FColor* out) {
+                    bool has_far = q < up_probes;
+                    const SDL_FColor* above = has_far ? &cones_up[cone(f, m, q, 0, s)] : nullptr;
+                    int v0 = has_far ? std::min(std::max(tile.y0, -o), tile.y1) : tile.y1;
+                    int v1 = has_far ? std::max(std::min(tile.y1, f.V - o), v0) : tile.y1;
+                    // all four channels alike so that they go as one vector,
+                    // the alpha of a cone is never read
+                    SDL_FColor* c = out - tile.y0;
+                    for (int v = tile.y0; v < v0; ++v) {
+                        c[v].r += w * r[v].r; c[v].g += w * r[v].g; c[v].b += w * r[v].b; c[v].a += w * r[v].a;
+                    }
+                    for (int v = v0; v < v1; ++v) {
+                        SDL_FColor x = r[v], a = above[v + o];
+                        float t = w * x.a;
+                        c[v].r += w * x.r + t * a.r; c[v].g += w * x.g + t * a.g;
+                        c[v].b += w * x.b + t * a.b; c[v].a += w * x.a + t * a.a;
+                    }
+                    for (int v = v1; v < tile.y1; ++v) {
+                        c[v].r += w * r[v].r; c[v].g += w * r[v].g; c[v].b += w * r[v].b; c[v].a += w * r[v].a;
+                    }
+                };
+                thread_local std::vector<SDL_FColor> acc;
+                acc.resize(tile.y1 - tile.y0);
+                for (int i = tile.x0; i < tile.x1; ++i)
+                    for (int k = 0; k < half; ++k) {
+                        std::fill(acc.begin(), acc.end(), SDL_FColor{0, 0, 0, 1});
+                        for (int s = 2 * k; s <= 2 * k + 1; ++s) {
+                            float w = share[m][s];
+                            if (i % 2) {
+                                // window of 1 on column u + 2^n, probes of n+1 there
+                                for (int o = s - half; o <= s + 1 - half; ++o)
+                                    through(&rays[n][ray(f, n, i, 0, o)], (i + 1) / 2, o, s, 0.5f * w, acc.data());
+                            }
+                            else {
+                                // window of 2 on column u + 2^(n+1), with the rays of n+1
+                                for (int e = 0; e < 3; ++e) {
+                                    int o = 2 * s - 2 * half + e;
+                                    through(&rays[m][ray(f, m, i / 2, 0, o)], i / 2 + 1, o, s, tw[e] * w, acc.data());
+                                }
+                            }
+                        }
+                        std::copy(acc.begin(), acc.end(), cones.begin() + cone(f, n, i, tile.y0, k));
+                    }
+            });
+            std::swap(cones, cones_up);
+        }
+
+        // level 0, one cone per probe
+        pool.parallel_for(tile_count(f.U, f.V, block), [&](int t, int) {
+            tile_t tile = tile_rect(t, f.U, f.V, block);
+            for (int u = tile.x0; u < tile.x1; ++u)
+                for (int v = tile.y0; v < tile.y1; ++v) {
+                    const SDL_FColor& c = cones_up[cone(f, 0, u, v, 0)];
+                    SDL_FColor& out = fluence[static_cast<size_t>(f.gx(u, v)) * gh + f.gy(u, v)];
+                    out.r += 0.25f * c.r; out.g += 0.25f * c.g; out.b += 0.25f * c.b;
+                }
+        });
+    }
+
+    // bilinear between the probes around every pixel
+    void gather(thread_pool& pool, int w, int h, color_buffer_t& light) {
+        pool.parallel_for(tile_count(w, h, block), [&](int t, int) {
+            tile_t tile = tile_rect(t, w, h, block);
+            for (int x = tile.x0; x < tile.x1; ++x) {
+                int   i0 = std::min(x / spacing, gw - 1), i1 = std::min(i0 + 1, gw - 1);
+                float tx = static_cast<float>(x - i0 * spacing) / spacing;
+                for (int y = tile.y0; y < tile.y1; ++y) {
+                    int   j0 = std::min(y / spacing, gh - 1), j1 = std::min(j0 + 1, gh - 1);
+                    float ty = static_cast<float>(y - j0 * spacing) / spacing;
+                    const SDL_FColor& c00 = fluence[static_cast<size_t>(i0) * gh + j0];
+                    const SDL_FColor& c10 = fluence[static_cast<size_t>(i1) * gh + j0];
+                    const SDL_FColor& c01 = fluence[static_cast<size_t>(i0) * gh + j1];
+                    const SDL_FColor& c11 = fluence[static_cast<size_t>(i1) * gh + j1];
+                    float w00 = (1 - tx) * (1 - ty), w10 = tx * (1 - ty), w01 = (1 - tx) * ty, w11 = tx * ty;
+                    light.set(pixel_index(x, y, h), {c00.r * w00 + c10.r * w10 + c01.r * w01 + c11.r * w11,
+                                                     c00.g * w00 + c10.g * w10 + c01.g * w01 + c11.g * w11,
+                                                     c00.b * w00 + c10.b * w10 + c01.b * w01 + c11.b * w11, 1.0f});
+                }
+            }
+        });
+    }
+};
+
+#endif
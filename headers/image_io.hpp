@@ -0,0 +1,207 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Minimal image writers for offline renders, no external dependencies.
+//   .ppm - 8-bit binary RGB
+//   .png - 8-bit RGB, uncompressed (stored) deflate
+//   .pfm - 32-bit float RGB, keeps HDR values untouched
+// image_writer_t writes them in the background.
+
+// row-major RGB, row 0 at the top
+struct image_t {
+    int w = 0, h = 0;
+    std::vector<float> rgb;
+
+    image_t() {}
+    image_t(int _w, int _h) : w(_w), h(_h), rgb(static_cast<size_t>(_w) * _h * 3, 0.0f) {}
+
+    float* at(int x, int y) { return &rgb[(static_cast<size_t>(y) * w + x) * 3]; }
+};
+
+inline uint8_t to_byte(float v) {
+    v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+    return static_cast<uint8_t>(v * 255.0f + 0.5f);
+}
+
+inline bool write_ppm(const std::string& path, const image_t& img) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "P6\n%d %d\n255\n", img.w, img.h);
+    std::vector<uint8_t> row(img.w * 3);
+    for (int y = 0; y < img.h; ++y) {
+        for (int i = 0; i < img.w * 3; ++i)
+            row[i] = to_byte(img.rgb[static_cast<size_t>(y) * img.w * 3 + i]);
+        fwrite(row.data(), 1, row.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+// PFM stores rows bottom to top, negative scale marks little endian
+inline bool write_pfm(const std::string& path, const image_t& img) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "PF\n%d %d\n-1.0\n", img.w, img.h);
+    for (int y = img.h - 1; y >= 0; --y)
+        fwrite(&img.rgb[static_cast<size_t>(y) * img.w * 3], sizeof(float), img.w * 3, f);
+    return fclose(f) == 0;
+}
+
+inline uint32_t png_crc(const uint8_t* data, size_t len, uint32_t crc = 0xffffffffu) {
+    static uint32_t table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        ready = true;
+    }
+    for (size_t i = 0; i < len; ++i) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+inline void png_chunk(FILE* f, const char* type, const std::vector<uint8_t>& data) {
+    uint8_t head[8] = {uint8_t(data.size() >> 24), uint8_t(data.size() >> 16), uint8_t(data.size() >> 8), uint8_t(data.size()),
+                       uint8_t(type[0]), uint8_t(type[1]), uint8_t(type[2]), uint8_t(type[3])};
+    fwrite(head, 1, 8, f);
+    if (!data.empty()) fwrite(data.data(), 1, data.size(), f);
+    uint32_t crc = png_crc(head + 4, 4);
+    crc = png_crc(data.data(), data.size(), crc) ^ 0xffffffffu;
+    uint8_t tail[4] = {uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc)};
+    fwrite(tail, 1, 4, f);
+}
+
+inline bool write_png(const std::string& path, const image_t& img) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    const uint8_t sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(sig, 1, 8, f);
+
+    std::vector<uint8_t> ihdr = {uint8_t(img.w >> 24), uint8_t(img.w >> 16), uint8_t(img.w >> 8), uint8_t(img.w),
+                                 uint8_t(img.h >> 24), uint8_t(img.h >> 16), uint8_t(img.h >> 8), uint8_t(img.h),
+                                 8, 2, 0, 0, 0};
+    png_chunk(f, "IHDR", ihdr);
+
+    // scanlines with filter type 0
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<size_t>(img.w * 3 + 1) * img.h);
+    for (int y = 0; y < img.h; ++y) {
+        raw.push_back(0);
+        for (int i = 0; i < img.w * 3; ++i)
+            raw.push_back(to_byte(img.rgb[static_cast<size_t>(y) * img.w * 3 + i]));
+    }
+
+    // zlib stream made of stored deflate blocks
+    std::vector<uint8_t> z = {0x78, 0x01};
+    size_t pos = 0;
+    do {
+        size_t n = raw.size() - pos < 65535 ? raw.size() - pos : 65535;
+        z.push_back(pos + n == raw.size() ? 1 : 0);
+        z.push_back(uint8_t(n));
+        z.push_back(uint8_t(n >> 8));
+        z.push_back(uint8_t(~n));
+        z.push_back(uint8_t(~n >> 8));
+        z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + n);
+        pos += n;
+    } while (pos < raw.size());
+    uint32_t a = 1, b = 0;
+    for (uint8_t c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    z.push_back(uint8_t(adler >> 24));
+    z.push_back(uint8_t(adler >> 16));
+    z.push_back(uint8_t(adler >> 8));
+    z.push_back(uint8_t(adler));
+    png_chunk(f, "IDAT", z);
+    png_chunk(f, "IEND", {});
+
+    return fclose(f) == 0;
+}
+
+// picks the format from the file extension
+inline bool write_image(const std::string& path, const image_t& img) {
+    auto ends_with = [&](const char* ext) {
+        size_t n = strlen(ext);
+        return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+    };
+    if (ends_with(".pfm")) return write_pfm(path, img);
+    if (ends_with(".png")) return write_png(path, img);
+    return write_ppm(path, img);
+}
+
+// Writes images on a thread of its own, so rendering goes on while the last
+// frames are encoded and written. At most `depth` images wait, push() blocks
+// beyond that so a slow disk cannot pile up frames in memory.
+class image_writer_t {
+public:
+    explicit image_writer_t(size_t _depth = 4) : depth(_depth > 0 ? _depth : 1) {
+        writer = std::thread(&image_writer_t::run, this);
+    }
+    ~image_writer_t() { finish(); }
+
+    image_writer_t(const image_writer_t&) = delete;
+    image_writer_t& operator=(const image_writer_t&) = delete;
+
+    void push(std::string path, image_t img) {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&] { return queue.size() < depth; });
+        queue.emplace_back(std::move(path), std::move(img));
+        cv.notify_all();
+    }
+
+    // waits for everything pushed so far and stops the thread
+    void finish() {
+        if (!writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        writer.join();
+    }
+
+    // images written, and ones that could not be, once finish() returned
+    long written() const { return n_written; }
+    long failed() const  { return n_failed; }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lk(m);
+        for (;;) {
+            cv.wait(lk, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            std::pair<std::string, image_t> job = std::move(queue.front());
+            queue.pop_front();
+            cv.notify_all();
+            lk.unlock();
+            bool ok = write_image(job.first, job.second);
+            if (!ok) fprintf(stderr, "Could not write %s\n", job.first.c_str());
+            lk.lock();
+            ++(ok ? n_written : n_failed);
+        }
+    }
+
+    size_t depth;
+    std::deque<std::pair<std::string, image_t>> queue;
+    std::thread writer;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+    long n_written = 0, n_failed = 0;
+};
+
+#endif
@@ -0,0 +1,641 @@
+#ifndef MARCH_H
+#define MARCH_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "geometry.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RC_X86
+#include <immintrin.h>
+#endif
+
+// Sphere tracing through buf_dist, one ray at a time or as packets of 4/8 rays
+// that share a length (all rays of a cascade do), or DDA through a bitmask of
+// the occupied pixels. The packet marchers keep
+// every lane in SoA form, retire lanes with a mask as they hit or leave the
+// screen, and do exactly the scalar float operations, so their output matches
+// march_ray() bit for bit.
+
+// SIMD_SCALAR - one ray after another
+// SIMD_SSE    - 4 rays per packet (SSE4.1), distance loads done per lane
+// SIMD_AVX2   - 8 rays per packet, gathered distance loads
+//
+// The SSE refill goes through memory and only pays off once rays take many
+// steps, so shorter cascades march scalar at that level. Over a distance
+// pyramid every level marches scalar.
+enum simd_levels {
+    SIMD_SCALAR,
+    SIMD_SSE,
+    SIMD_AVX2
+};
+
+// Min-distance pyramid over the distance field: level L holds the smallest
+// distance of every 2^L x 2^L block of pixels, x-major like the field. Level 0
+// is the field itself and is not stored.
+struct dist_pyramid_t {
+    int w = 0, h = 0, top = 0;
+    std::vector<std::vector<float>> level;  // level[L], empty for L = 0
+
+    void resize(int _w, int _h, int _top) {
+        w = _w; h = _h; top = _top;
+        level.assign(top + 1, std::vector<float>());
+        for (int L = 1; L <= top; ++L) level[L].assign(static_cast<size_t>(width(L)) * height(L), 0.0f);
+    }
+    int width(int L) const  { return (w + (1 << L) - 1) >> L; }
+    int height(int L) const { return (h + (1 << L) - 1) >> L; }
+    float at(int L, int bx, int by) const { return level[L][static_cast<size_t>(bx) * height(L) + by]; }
+
+    // recomputes columns [x0, x1) of level L from the level below, level 1
+    // from the field (laid out as pixel_index() says)
+    void reduce(int L, const float* dist, int x0, int x1) {
+        int bw = L == 1 ? w : width(L - 1), bh = L == 1 ? h : height(L - 1), lh = height(L);
+        auto below = [&](int x, int y) {
+            return L == 1 ? dist[pixel_index(x, y, h)] : level[L - 1][static_cast<size_t>(x) * bh + y];
+        };
+        float* out = level[L].data();
+        for (int x = x0; x < x1; ++x) {
+            int xa = 2 * x, xb = std::min(2 * x + 1, bw - 1);
+            for (int y = 0; y < lh; ++y) {
+                int ya = 2 * y, yb = std::min(2 * y + 1, bh - 1);
+                out[static_cast<size_t>(x) * lh + y] = std::min(std::min(below(xa, ya), below(xa, yb)),
+                                                                std::min(below(xb, ya), below(xb, yb)));
+            }
+        }
+    }
+};
+
+// One bit per pixel, set where something was drawn (color.a != 0, the pixels
+// the EDT starts from), packed in 8x8 blocks: word (bx, by) x-major, bit
+// (x & 7) * 8 + (y & 7). An empty word is 64 pixels a ray crosses untested.
+struct occupancy_t {
+    int w = 0, h = 0, bw = 0, bh = 0;
+    std::vector<uint64_t> block;
+
+    void resize(int _w, int _h) {
+        w = _w; h = _h;
+        bw = (w + 7) / 8; bh = (h + 7) / 8;
+        block.assign(static_cast<size_t>(bw) * bh, 0);
+    }
+    uint64_t word(int bx, int by) const { return block[static_cast<size_t>(bx) * bh + by]; }
+
+    // whether any pixel of r (inside the screen) is set
+    bool any(const rect_t& r) const {
+        for (int bx = r.x0 >> 3; bx <= (r.x1 - 1) >> 3; ++bx)
+            for (int by = r.y0 >> 3; by <= (r.y1 - 1) >> 3; ++by) {
+                uint64_t bits = word(bx, by);
+                if (!bits) continue;
+                uint64_t rows = (0xffu << std::max(0, r.y0 - by * 8)) & (0xffu >> std::max(0, by * 8 + 8 - r.y1));
+                for (int x = std::max(bx * 8, r.x0); x < std::min(bx * 8 + 8, r.x1); ++x)
+                    if (bits >> ((x & 7) * 8) & rows) return true;
+            }
+        return false;
+    }
+
+    // rebuilds the blocks overlapping r from obj (w x h, see pixel_index())
+    void build(const material_t* obj, const rect_t& r) {
+        for (int bx = r.x0 / 8; bx < (r.x1 + 7) / 8; ++bx)
+            for (int by = r.y0 / 8; by < (r.y1 + 7) / 8; ++by) {
+                uint64_t bits = 0;
+                for (int x = bx * 8; x < std::min(bx * 8 + 8, w); ++x)
+                    for (int y = by * 8; y < std::min(by * 8 + 8, h); ++y)
+                        if (obj[pixel_index(x, y, h)].color.a != 0) bits |= uint64_t(1) << ((x & 7) * 8 + (y & 7));
+                block[static_cast<size_t>(bx) * bh + by] = bits;
+            }
+    }
+};
+
+// One flag per 8x8 block of pixels (x-major like occupancy_t) for blocks
+// something may have been drawn to since they were last taken. Marking a
+// whole box is a handful of stores, so it costs nothing per pixel.
+struct block_marks_t {
+    int w = 0, h = 0, bw = 0, bh = 0;
+    std::vector<uint8_t> mark;
+
+    void resize(int _w, int _h) {
+        w = _w; h = _h;
+        bw = (w + 7) / 8; bh = (h + 7) / 8;
+        mark.assign(static_cast<size_t>(bw) * bh, 0);
+    }
+
+    // r inside the screen
+    void set(const rect_t& r) {
+        for (int bx = r.x0 / 8; bx < (r.x1 + 7) / 8; ++bx)
+            for (int by = r.y0 / 8; by < (r.y1 + 7) / 8; ++by) mark[static_cast<size_t>(bx) * bh + by] = 1;
+    }
+
+    // calls clear(part) for the part of r in every marked block; blocks r
+    // covers entirely are unmarked, the others may still hold drawn pixels
+    template <typename F>
+    void take(const rect_t& r, F clear) {
+        for (int bx = r.x0 / 8; bx < (r.x1 + 7) / 8; ++bx)
+            for (int by = r.y0 / 8; by < (r.y1 + 7) / 8; ++by) {
+                uint8_t& m = mark[static_cast<size_t>(bx) * bh + by];
+                if (!m) continue;
+                rect_t b    = rect_t{bx * 8, by * 8, bx * 8 + 8, by * 8 + 8}.clip({0, 0, w, h});
+                rect_t part = b.clip(r);
+                clear(part);
+                if (part == b) m = 0;
+            }
+    }
+};
+
+// Packed scene cell: the distance and the material of a pixel in one word,
+// so a march step is one 4 byte load instead of a float and, on a hit, a
+// 20 byte material_t from another array. Low 16 bits the distance in 1/16
+// pixels, rounded down (a shorter sphere step is still safe) and saturated,
+// but never 0 off surfaces; high 16 bits the index of the material in a
+// palette, 0 where nothing was drawn.
+const float CELL_SCALE = 16.0f;
+
+inline uint32_t cell_distance_bits(float d) {
+    if (d < 0.001f) return 0;
+    float q = d * CELL_SCALE;
+    return q >= 65535.0f ? 65535u : std::max(1u, static_cast<uint32_t>(q));
+}
+inline float cell_dist(uint32_t c) { return static_cast<float>(c & 0xffff) * (1.0f / CELL_SCALE); }
+inline uint32_t cell_material(uint32_t c) { return c >> 16; }
+
+// the distinct materials of a scene, entry 0 being nothing
+struct material_palette_t {
+    std::vector<material_t> entries;
+
+    void clear() {
+        entries.assign(1, material_t({0, 0, 0, 0}, 0));
+        index.clear();
+    }
+    // index of m, added if new; -1 once the 16 bits are used up
+    int find(const material_t& m) {
+        key_t k;
+        memcpy(k.v, &m.color, sizeof(k.v) - sizeof(float));
+        k.v[4] = m.emissivity;
+        auto it = index.find(k);
+        if (it != index.end()) return it->second;
+        if (entries.size() > 0xffff) return -1;
+        index.emplace(k, static_cast<int>(entries.size()));
+        entries.push_back(m);
+        return static_cast<int>(entries.size()) - 1;
+    }
+
+private:
+    struct key_t {
+        float v[5];
+        bool operator==(const key_t& o) const { return memcmp(v, o.v, sizeof(v)) == 0; }
+    };
+    struct key_hash {
+        size_t operator()(const key_t& k) const {
+            uint32_t b[5];
+            memcpy(b, k.v, sizeof(b));
+            size_t h = 0;
+            for (uint32_t x : b) h = (h ^ x) * 0x100000001b3ull;
+            return h;
+        }
+    };
+    std::unordered_map<key_t, int, key_hash> index;
+};
+
+// A block step may only go as far past the block as its smallest distance
+// less this: a point of the block is up to a pixel diagonal from the sample
+// of its pixel, and a point beyond it up to another from the pixel it lands in.
+constexpr float mip_margin = 2.9f;
+
+// the distance field and object buffer, laid out as pixel_index() says. With `mip` rays
+// stride over whole blocks of it where those are clear, with `occ` they are
+// traced through that instead and dist is not read. With `cell` both are read
+// from the packed cells and `palette`. With `steps` every march_rays() call
+// adds the lookups it made, with `max_steps` raises it to the most one of its
+// rays made.
+struct march_field_t {
+    const float*      dist;
+    const material_t* obj;
+    int w, h;
+    const dist_pyramid_t* mip = nullptr;
+    std::atomic<long>*    steps = nullptr;
+    std::atomic<long>*    max_steps = nullptr;
+    const occupancy_t*    occ = nullptr;
+    const uint32_t*       cell = nullptr;
+    const material_t*     palette = nullptr;
+
+    int at(int x, int y) const { return pixel_index(x, y, h); }
+    float dist_at(int p) const { return cell ? cell_dist(cell[p]) : dist[p]; }
+    const material_t& material_at(int p) const { return cell ? palette[cell_material(cell[p])] : obj[p]; }
+};
+
+inline int simd_detect() {
+#if defined(RC_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))   return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SIMD_SSE;
+#endif
+    return SIMD_SCALAR;
+}
+
+inline const char* simd_name(int level) {
+    switch (level) {
+        case SIMD_AVX2: return "AVX2";
+        case SIMD_SSE:  return "SSE4.1";
+        default:        return "scalar";
+    }
+}
+
+inline void atomic_max(std::atomic<long>& a, long v) {
+    long cur = a;
+    while (v > cur && !a.compare_exchange_weak(cur, v)) {}
+}
+
+// shortest ray length for which the SSE marcher beats the scalar one
+inline float sse_min_len = 256.0f;
+
+inline SDL_FColor hit_color(const material_t& m) {
+    return {m.color.r * m.emissivity, m.color.g * m.emissivity, m.color.b * m.emissivity, 0.0};
+}
+
+inline SDL_FColor march_ray(const march_field_t& f, vec2 r_orig, vec2 r_dir, float r_len, long& steps) {
+    SDL_FColor hit = {0.0, 0.0, 0.0, 1.0};
+    float distance, tot_distance = 0;
+    vec2 position;
+    while (tot_distance < r_len) {
+        ++steps;
+        position = r_orig + r_dir * tot_distance;
+
+        if (position.x < 0 || position.y < 0 || position.x >= f.w || position.y >= f.h)
+            break;
+
+        int p = f.at(static_cast<int>(position.x), static_cast<int>(position.y));
+        distance = f.dist_at(p);
+
+        if (distance < 0.001) {
+            hit = hit_color(f.material_at(p));
+            break;
+        }
+
+        tot_distance += distance;
+    }
+
+    return hit;
+}
+
+inline SDL_FColor march_ray(const march_field_t& f, vec2 r_orig, vec2 r_dir, float r_len) {
+    long steps = 0;
+    return march_ray(f, r_orig, r_dir, r_len, steps);
+}
+
+// exit distance from p of the 2^L block (bx, by) along a direction with
+// inverse components (ix, iy), huge for a zero component
+inline float block_exit(float px, float py, float ix, float iy, int bx, int by, int L) {
+    float ex = static_cast<float>((bx + (ix >= 0.0f)) << L);
+    float ey = static_cast<float>((by + (iy >= 0.0f)) << L);
+    return std::min((ex - px) * ix, (ey - py) * iy);
+}
+
+// march_ray() over the pyramid: where the pixel's block at level L is at
+// least mip_margin from every surface, the ray may leave the block and go
+// on by its smallest distance less the margin, the longest such step of
+// the levels that allow one is taken.
+inline SDL_FColor march_ray_mip(const march_field_t& f, vec2 r_orig, vec2 r_dir, float r_len, long& steps) {
+    const dist_pyramid_t& mip = *f.mip;
+    float ix = r_dir.x != 0.0f ? 1.0f / r_dir.x : 1e30f, iy = r_dir.y != 0.0f ? 1.0f / r_dir.y : 1e30f;
+    float t = 0;
+    while (t < r_len) {
+        ++steps;
+        vec2 position = r_orig + r_dir * t;
+        if (position.x < 0 || position.y < 0 || position.x >= f.w || position.y >= f.h)
+            break;
+
+        int x = static_cast<int>(position.x), y = static_cast<int>(position.y);
+        int p = f.at(x, y);
+        float step = f.dist_at(p);
+        if (step < 0.001)
+            return hit_color(f.material_at(p));
+
+        // a long pixel step already leaves any block it could stride over
+        for (int L = 1; L <= mip.top; ++L) {
+            float m = mip.at(L, x >> L, y >> L);
+            if (m <= mip_margin) break;
+            step = std::max(step, block_exit(position.x, position.y, ix, iy, x >> L, y >> L, L) + m - mip_margin);
+        }
+        t += step;
+    }
+    return {0.0, 0.0, 0.0, 1.0};
+}
+
+// The first occupied pixel the ray crosses before r_len or the screen edge.
+// Walks the 8x8 blocks the ray crosses and only steps pixel by pixel through
+// the ones that hold something; a ray starting off the screen escapes, like
+// in march_ray(). Counts every block and pixel visited as a step.
+inline SDL_FColor march_ray_dda(const march_field_t& f, vec2 o, vec2 d, float r_len, long& steps) {
+    const SDL_FColor miss = {0.0, 0.0, 0.0, 1.0};
+    if (o.x < 0 || o.y < 0 || o.x >= f.w || o.y >= f.h) return miss;
+    const occupancy_t& occ = *f.occ;
+    float ix = d.x != 0.0f ? 1.0f / d.x : 1e30f, iy = d.y != 0.0f ? 1.0f / d.y : 1e30f;
+    int sx = d.x > 0.0f ? 1 : -1, sy = d.y > 0.0f ? 1 : -1;
+    // t of the first x (y) boundary after coordinate c of a grid of cells n wide
+    auto next_x = [&](int c, int n) { return d.x == 0.0f ? 1e30f : ((c + (d.x > 0.0f)) * n - o.x) * ix; };
+    auto next_y = [&](int c, int n) { return d.y == 0.0f ? 1e30f : ((c + (d.y > 0.0f)) * n - o.y) * iy; };
+
+    // past the screen edge nothing is occupied
+    r_len = std::min(r_len, std::min(d.x == 0.0f ? 1e30f : ((d.x > 0.0f ? f.w : 0) - o.x) * ix,
+                                     d.y == 0.0f ? 1e30f : ((d.y > 0.0f ? f.h : 0) - o.y) * iy));
+    int x = static_cast<int>(o.x), y = static_cast<int>(o.y);
+    int bx = x >> 3, by = y >> 3;
+    float t = 0.0f, bnx = next_x(bx, 8), bny = next_y(by, 8);
+    while (t < r_len) {
+        ++steps;
+        float t_out = std::min(std::min(bnx, bny), r_len);
+        uint64_t bits = occ.word(bx, by);
+        if (bits) {
+            // the pixel the ray is in when it enters the block
+            vec2 p = o + d * t;
+            x = std::min(std::max(static_cast<int>(p.x), bx * 8), bx * 8 + 7);
+            y = std::min(std::max(static_cast<int>(p.y), by * 8), by * 8 + 7);
+            float pnx = next_x(x, 1), pny = next_y(y, 1), tp = t;
+            while (tp < t_out) {
+                ++steps;
+                if ((bits >> ((x & 7) * 8 + (y & 7))) & 1) return hit_color(f.material_at(f.at(x, y)));
+                if (pnx < pny) { tp = pnx; x += sx; pnx += std::abs(ix); }
+                else           { tp = pny; y += sy; pny += std::abs(iy); }
+                if ((x >> 3) != bx || (y >> 3) != by) break;
+            }
+        }
+        if (bnx < bny) { t = bnx; bx += sx; bnx += 8 * std::abs(ix); }
+        else           { t = bny; by += sy; bny += 8 * std::abs(iy); }
+        if (bx < 0 || by < 0 || bx >= occ.bw || by >= occ.bh) break;
+    }
+    return miss;
+}
+
+inline void march_rays_dda(const march_field_t& f, const float* ox, const float* oy,
+                           const float* dx, const float* dy, float r_len, int n, SDL_FColor* out) {
+    long steps = 0, most = 0;
+    for (int i = 0; i < n; ++i) {
+        long before = steps;
+        out[i] = march_ray_dda(f, vec2(ox[i], oy[i]), vec2(dx[i], dy[i]), r_len, steps);
+        most = std::max(most, steps - before);
+    }
+    if (f.steps) *f.steps += steps;
+    if (f.max_steps) atomic_max(*f.max_steps, most);
+}
+
+inline void march_rays_scalar(const march_field_t& f, const float* ox, const float* oy,
+                              const float* dx, const float* dy, float r_len, int n, SDL_FColor* out) {
+    long steps = 0, most = 0;
+    for (int i = 0; i < n; ++i) {
+        long before = steps;
+        out[i] = f.mip ? march_ray_mip(f, vec2(ox[i], oy[i]), vec2(dx[i], dy[i]), r_len, steps)
+                       : march_ray(f, vec2(ox[i], oy[i]), vec2(dx[i], dy[i]), r_len, steps);
+        most = std::max(most, steps - before);
+    }
+    if (f.steps) *f.steps += steps;
+    if (f.max_steps) atomic_max(*f.max_steps, most);
+}
+
+#if defined(RC_X86) && defined(__GNUC__)
+// pixel_index() per lane, `stride` being pixel_stride(h)
+__attribute__((target("sse4.1")))
+inline __m128i pixel_index_sse(__m128i x, __m128i y, __m128i stride) {
+#ifdef PIXEL_TILED
+    const int s = PIXEL_TILE_LOG2;
+    __m128i m = _mm_set1_epi32((1 << s) - 1);
+    __m128i tiles = _mm_add_epi32(_mm_mullo_epi32(_mm_srli_epi32(x, s), stride), _mm_slli_epi32(_mm_srli_epi32(y, s), 2 * s));
+    return _mm_add_epi32(tiles, _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(x, m), s), _mm_and_si128(y, m)));
+#else
+    return _mm_add_epi32(_mm_mullo_epi32(x, stride), y);
+#endif
+}
+
+__attribute__((target("avx2")))
+inline __m256i pixel_index_avx2(__m256i x, __m256i y, __m256i stride) {
+#ifdef PIXEL_TILED
+    const int s = PIXEL_TILE_LOG2;
+    __m256i m = _mm256_set1_epi32((1 << s) - 1);
+    __m256i tiles = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(x, s), stride), _mm256_slli_epi32(_mm256_srli_epi32(y, s), 2 * s));
+    return _mm256_add_epi32(tiles, _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(x, m), s), _mm256_and_si256(y, m)));
+#else
+    return _mm256_add_epi32(_mm256_mullo_epi32(x, stride), y);
+#endif
+}
+
+// SSE lane state lives in these arrays while lanes are retired and refilled, and
+// in registers while they step. A lane takes the next ray of the stream as soon as
+// its own ray stops, so a packet never idles waiting for its longest ray.
+struct march_lanes_t {
+    alignas(32) float ox[8], oy[8], dx[8], dy[8], t[8];
+    alignas(32) int   id[8], hit[8], live[8], steps[8];
+    int next = 0;
+
+    // puts ray `next` into lane k, or parks the lane once the stream is empty
+    void refill(int k, int n, const float* rox, const float* roy, const float* rdx, const float* rdy) {
+        if (next < n) {
+            ox[k] = rox[next]; oy[k] = roy[next];
+            dx[k] = rdx[next]; dy[k] = rdy[next];
+            t[k] = 0.0f; id[k] = next++; hit[k] = -1; live[k] = -1;
+        }
+        else {
+            ox[k] = oy[k] = dx[k] = dy[k] = t[k] = 0.0f;
+            id[k] = -1; hit[k] = -1; live[k] = 0;
+        }
+        steps[k] = 0;
+    }
+
+    void retire(int k, const march_field_t& f, SDL_FColor* out) {
+        out[id[k]] = hit[k] >= 0 ? hit_color(f.material_at(hit[k])) : SDL_FColor{0.0, 0.0, 0.0, 1.0};
+    }
+};
+
+__attribute__((target("sse4.1")))
+inline void march_rays_sse(const march_field_t& f, const float* rox, const float* roy,
+                           const float* rdx, const float* rdy, float r_len, int n, SDL_FColor* out) {
+    if (n <= 0) return;
+    long steps = 0, most = 0;
+    march_lanes_t L;
+    alignas(16) float ld[4];
+    alignas(16) int   li[4];
+    for (int k = 0; k < 4; ++k) L.refill(k, n, rox, roy, rdx, rdy);
+
+    __m128 vlen = _mm_set1_ps(r_len), eps = _mm_set1_ps(0.001f), zero = _mm_setzero_ps();
+    __m128 vw = _mm_set1_ps(static_cast<float>(f.w)), vh = _mm_set1_ps(static_cast<float>(f.h));
+    __m128i vstride = _mm_set1_epi32(pixel_stride(f.h));
+
+    for (;;) {
+        __m128 vox = _mm_load_ps(L.ox), voy = _mm_load_ps(L.oy);
+        __m128 vdx = _mm_load_ps(L.dx), vdy = _mm_load_ps(L.dy);
+        __m128 t = _mm_load_ps(L.t);
+        __m128i hit_idx = _mm_load_si128(reinterpret_cast<const __m128i*>(L.hit));
+        __m128 live = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(L.live)));
+        __m128 active = _mm_and_ps(live, _mm_cmplt_ps(t, vlen));
+        __m128 retired = _mm_andnot_ps(active, live);
+        __m128i lane_steps = _mm_load_si128(reinterpret_cast<const __m128i*>(L.steps));
+
+        while (_mm_movemask_ps(active) && __builtin_popcount(_mm_movemask_ps(retired)) < 2) {
+            __m128 px = _mm_add_ps(vox, _mm_mul_ps(vdx, t));
+            __m128 py = _mm_add_ps(voy, _mm_mul_ps(vdy, t));
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(px, zero), _mm_cmpge_ps(py, zero)),
+                                       _mm_and_ps(_mm_cmplt_ps(px, vw), _mm_cmplt_ps(py, vh)));
+            __m128 stepping = _mm_and_ps(active, inside);
+
+            __m128i idx = pixel_index_sse(_mm_cvttps_epi32(px), _mm_cvttps_epi32(py), vstride);
+            _mm_store_si128(reinterpret_cast<__m128i*>(li), idx);
+            int m = _mm_movemask_ps(stepping);
+            steps += __builtin_popcount(_mm_movemask_ps(active));
+            lane_steps = _mm_sub_epi32(lane_steps, _mm_castps_si128(active));
+            for (int k = 0; k < 4; ++k)
+                ld[k] = (m >> k) & 1 ? f.dist_at(li[k]) : 0.0f;
+            __m128 d = _mm_load_ps(ld);
+
+            __m128 hit = _mm_and_ps(stepping, _mm_cmplt_ps(d, eps));
+            hit_idx = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(hit_idx), _mm_castsi128_ps(idx), hit));
+            stepping = _mm_andnot_ps(hit, stepping);
+
+            t = _mm_blendv_ps(t, _mm_add_ps(t, d), stepping);
+            __m128 still = _mm_and_ps(stepping, _mm_cmplt_ps(t, vlen));
+            retired = _mm_or_ps(retired, _mm_andnot_ps(still, active));
+            active = still;
+        }
+
+        _mm_store_ps(L.t, t);
+        _mm_store_si128(reinterpret_cast<__m128i*>(L.hit), hit_idx);
+        _mm_store_si128(reinterpret_cast<__m128i*>(L.steps), lane_steps);
+        int m = _mm_movemask_ps(retired);
+        bool any = false;
+        for (int k = 0; k < 4; ++k) {
+            if ((m >> k) & 1) {
+                most = std::max(most, static_cast<long>(L.steps[k]));
+                L.retire(k, f, out);
+                L.refill(k, n, rox, roy, rdx, rdy);
+            }
+            any |= L.live[k] != 0;
+        }
+        if (!any) break;
+    }
+    if (f.steps) *f.steps += steps;
+    if (f.max_steps) atomic_max(*f.max_steps, most);
+}
+
+// For every 8-bit lane mask, lane k holds how many masked lanes come before it.
+// Permuting 8 consecutive stream rays by this table drops them into the retired
+// lanes in order, so the AVX2 marcher refills lanes without leaving registers.
+struct expand_lut_t {
+    alignas(32) int perm[256][8];
+    expand_lut_t() {
+        for (int m = 0; m < 256; ++m) {
+            int r = 0;
+            for (int k = 0; k < 8; ++k) perm[m][k] = (m >> k) & 1 ? r++ : 0;
+        }
+    }
+};
+inline const expand_lut_t expand_lut;
+
+template <bool CELL>
+__attribute__((target("avx2")))
+inline void march_rays_avx2_t(const march_field_t& f, const float* rox, const float* roy,
+                            const float* rdx, const float* rdy, float r_len, int n, SDL_FColor* out) {
+    if (n <= 0) return;
+    long steps = 0, most = 0;
+    alignas(32) int li[8], lh[8], ls[8];
+    __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 vlen = _mm256_set1_ps(r_len), eps = _mm256_set1_ps(0.001f), zero = _mm256_setzero_ps();
+    __m256 vw = _mm256_set1_ps(static_cast<float>(f.w)), vh = _mm256_set1_ps(static_cast<float>(f.h));
+    __m256i vstride = _mm256_set1_epi32(pixel_stride(f.h));
+
+    __m256 vox = zero, voy = zero, vdx = zero, vdy = zero, t = zero;
+    __m256i id = _mm256_set1_epi32(-1), hit_idx = _mm256_set1_epi32(-1), lane_steps = _mm256_setzero_si256();
+    __m256 active = zero;
+    __m256 retired = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    int next = 0;
+
+    for (;;) {
+        int m = _mm256_movemask_ps(retired);
+        if (m) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(li), id);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lh), hit_idx);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(ls), lane_steps);
+            for (int bits = m; bits; bits &= bits - 1) {
+                int k = __builtin_ctz(bits);
+                if (li[k] < 0) continue;
+                out[li[k]] = lh[k] >= 0 ? hit_color(f.material_at(lh[k])) : SDL_FColor{0.0, 0.0, 0.0, 1.0};
+                most = std::max(most, static_cast<long>(ls[k]));
+            }
+            lane_steps = _mm256_andnot_si256(_mm256_castps_si256(retired), lane_steps);
+
+            int remaining = n - next;
+            __m256i rank  = _mm256_load_si256(reinterpret_cast<const __m256i*>(expand_lut.perm[m]));
+            __m256i load  = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), iota);
+            __m256  fill  = _mm256_and_ps(retired, _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), rank)));
+
+            vox = _mm256_blendv_ps(vox, _mm256_permutevar8x32_ps(_mm256_maskload_ps(rox + next, load), rank), retired);
+            voy = _mm256_blendv_ps(voy, _mm256_permutevar8x32_ps(_mm256_maskload_ps(roy + next, load), rank), retired);
+            vdx = _mm256_blendv_ps(vdx, _mm256_permutevar8x32_ps(_mm256_maskload_ps(rdx + next, load), rank), retired);
+            vdy = _mm256_blendv_ps(vdy, _mm256_permutevar8x32_ps(_mm256_maskload_ps(rdy + next, load), rank), retired);
+            t   = _mm256_blendv_ps(t, zero, retired);
+            __m256i new_id = _mm256_add_epi32(_mm256_set1_epi32(next), rank);
+            id = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(id), _mm256_castsi256_ps(_mm256_set1_epi32(-1)), retired));
+            id = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(id), _mm256_castsi256_ps(new_id), fill));
+            hit_idx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hit_idx), _mm256_castsi256_ps(_mm256_set1_epi32(-1)), retired));
+
+            int filled = __builtin_popcount(m);
+            next += filled < remaining ? filled : remaining;
+            active = _mm256_or_ps(active, _mm256_and_ps(fill, _mm256_cmp_ps(t, vlen, _CMP_LT_OQ)));
+            retired = _mm256_andnot_ps(active, fill);   // zero-length rays retire straight away
+            if (!_mm256_movemask_ps(active) && !_mm256_movemask_ps(retired)) break;
+        }
+
+        int wait = next < n ? 4 : 9;
+        while (_mm256_movemask_ps(active) && __builtin_popcount(_mm256_movemask_ps(retired)) < wait) {
+            __m256 px = _mm256_add_ps(vox, _mm256_mul_ps(vdx, t));
+            __m256 py = _mm256_add_ps(voy, _mm256_mul_ps(vdy, t));
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(px, zero, _CMP_GE_OQ), _mm256_cmp_ps(py, zero, _CMP_GE_OQ)),
+                                          _mm256_and_ps(_mm256_cmp_ps(px, vw, _CMP_LT_OQ), _mm256_cmp_ps(py, vh, _CMP_LT_OQ)));
+            __m256 stepping = _mm256_and_ps(active, inside);
+            steps += __builtin_popcount(_mm256_movemask_ps(active));
+            lane_steps = _mm256_sub_epi32(lane_steps, _mm256_castps_si256(active));
+
+            __m256i idx = pixel_index_avx2(_mm256_cvttps_epi32(px), _mm256_cvttps_epi32(py), vstride);
+            __m256 d;
+            if (CELL) {
+                __m256i c = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(f.cell), idx,
+                                                        _mm256_castps_si256(stepping), 4);
+                d = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(c, _mm256_set1_epi32(0xffff))),
+                                  _mm256_set1_ps(1.0f / CELL_SCALE));
+            }
+            else
+                d = _mm256_mask_i32gather_ps(zero, f.dist, idx, stepping, 4);
+            __m256 hit = _mm256_and_ps(stepping, _mm256_cmp_ps(d, eps, _CMP_LT_OQ));
+            hit_idx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(hit_idx), _mm256_castsi256_ps(idx), hit));
+            stepping = _mm256_andnot_ps(hit, stepping);
+
+            t = _mm256_blendv_ps(t, _mm256_add_ps(t, d), stepping);
+            __m256 still = _mm256_and_ps(stepping, _mm256_cmp_ps(t, vlen, _CMP_LT_OQ));
+            retired = _mm256_or_ps(retired, _mm256_andnot_ps(still, active));
+            active = still;
+        }
+        if (!_mm256_movemask_ps(active) && !_mm256_movemask_ps(retired)) break;
+    }
+    if (f.steps) *f.steps += steps;
+    if (f.max_steps) atomic_max(*f.max_steps, most);
+}
+
+inline void march_rays_avx2(const march_field_t& f, const float* rox, const float* roy,
+                            const float* rdx, const float* rdy, float r_len, int n, SDL_FColor* out) {
+    if (f.cell) march_rays_avx2_t<true>(f, rox, roy, rdx, rdy, r_len, n, out);
+    else        march_rays_avx2_t<false>(f, rox, roy, rdx, rdy, r_len, n, out);
+}
+#endif
+
+// marches n rays of length r_len given as SoA origins and directions
+inline void march_rays(int level, const march_field_t& f, const float* ox, const float* oy,
+                       const float* dx, const float* dy, float r_len, int n, SDL_FColor* out) {
+    if (f.occ) { march_rays_dda(f, ox, oy, dx, dy, r_len, n, out); return; }
+#if defined(RC_X86) && defined(__GNUC__)
+    if (f.mip) level = SIMD_SCALAR;
+    if (level == SIMD_AVX2) { march_rays_avx2(f, ox, oy, dx, dy, r_len, n, out); return; }
+    if (level == SIMD_SSE && r_len >= sse_min_len) { march_rays_sse(f, ox, oy, dx, dy, r_len, n, out); return; }
+#endif
+    march_rays_scalar(f, ox, oy, dx, dy, r_len, n, out);
+}
+
+#endif
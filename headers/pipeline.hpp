@@ -0,0 +1,125 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pipelined viewer frames. A solver thread computes frames into a ring of
+// slots while the main thread presents the finished ones, so a frame costs
+// max(compute, present) instead of their sum. `depth` frames may be computed
+// ahead of the one on screen, each adding a frame of latency.
+//
+// Everything compute() touches (objects, the buffers, the settings) belongs to
+// the solver thread while the pipeline runs. The main thread only reads the
+// slots it was handed, and changes the scene through post(): edits queue up
+// and are applied on the solver thread between two frames, so every frame
+// sees one consistent snapshot of the scene.
+
+struct pipeline_frame_t {
+    std::vector<Uint32>     pixels;     // composited layers, row-major RGBA32, empty for none
+    std::vector<SDL_FColor> rays;       // every cascade (x * ray_h + y), empty unless asked for
+    int number = 0;                     // profile frame it was computed in
+};
+
+class frame_pipeline_t {
+public:
+    frame_pipeline_t() {}
+    ~frame_pipeline_t() { stop(); }
+
+    frame_pipeline_t(const frame_pipeline_t&) = delete;
+    frame_pipeline_t& operator=(const frame_pipeline_t&) = delete;
+
+    // starts the solver thread, which calls produce() for every frame
+    void start(int depth, std::function<void(pipeline_frame_t&)> _produce) {
+        stop();
+        produce = std::move(_produce);
+        // one slot on screen, `depth` queued or being computed
+        slots = std::vector<pipeline_frame_t>(std::max(depth, 1) + 1);
+        free_slots.clear();
+        ready.clear();
+        for (pipeline_frame_t& f : slots) free_slots.push_back(&f);
+        stopping = false;
+        solver = std::thread(&frame_pipeline_t::run, this);
+    }
+
+    // waits for the frame being computed, drops the edits still queued
+    void stop() {
+        if (!solver.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        solver.join();
+        edits.clear();
+    }
+
+    bool running() const { return solver.joinable(); }
+
+    // applied on the solver thread before the next frame is computed
+    void post(std::function<void()> edit) {
+        std::lock_guard<std::mutex> lk(m);
+        edits.push_back(std::move(edit));
+    }
+
+    // the oldest finished frame, nullptr if none is ready within timeout_ms
+    pipeline_frame_t* acquire(int timeout_ms) {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] { return !ready.empty(); });
+        if (ready.empty()) return nullptr;
+        pipeline_frame_t* f = ready.front();
+        ready.pop_front();
+        return f;
+    }
+
+    // hands a presented frame back for the solver to reuse
+    void release(pipeline_frame_t* f) {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            free_slots.push_back(f);
+        }
+        cv.notify_all();
+    }
+
+private:
+    void run() {
+        std::vector<std::function<void()>> pending;
+        for (;;) {
+            pipeline_frame_t* f;
+            {
+                std::unique_lock<std::mutex> lk(m);
+                cv.wait(lk, [&] { return stopping || !free_slots.empty(); });
+                if (stopping) return;
+                f = free_slots.front();
+                free_slots.pop_front();
+                pending.swap(edits);
+            }
+            for (auto& edit : pending) edit();
+            pending.clear();
+            produce(*f);
+            {
+                std::lock_guard<std::mutex> lk(m);
+                ready.push_back(f);
+            }
+            cv.notify_all();
+        }
+    }
+
+    std::function<void(pipeline_frame_t&)> produce;
+    std::vector<pipeline_frame_t>      slots;
+    std::deque<pipeline_frame_t*>      free_slots, ready;
+    std::vector<std::function<void()>> edits;
+    std::thread solver;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+};
+
+#endif
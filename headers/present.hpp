@@ -0,0 +1,127 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <SDL3/SDL.h>
+#include "radiance.hpp"
+
+// Viewer output. The distance map, lighting and object layers are composited
+// and quantised on the CPU into one streaming texture, uploaded once per frame
+// and drawn with a single copy, instead of one SDL_RenderPoint per pixel and
+// layer. Needs nothing but streaming textures, so it also runs on the software
+// renderer and the dummy video driver.
+//
+// Later layers cover earlier ones exactly like the point drawing did: the
+// lighting is opaque, objects only cover the pixels they were drawn into.
+// Channels are clamped to [0, 1] and truncated to 8 bits.
+
+struct present_layers_t {
+    bool dist    = false;
+    bool light   = false;
+    bool objects = true;
+};
+
+inline SDL_Texture* present_tex = nullptr;
+
+// (re)creates the texture for the current scr_w x scr_h
+inline bool init_present(SDL_Renderer* renderer) {
+    if (present_tex) SDL_DestroyTexture(present_tex);
+    // RGBA32 is R, G, B, A in memory whatever the endianness
+    present_tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, scr_w, scr_h);
+    if (!present_tex) {
+        fprintf(stderr, "Could not create a %dx%d streaming texture: %s\n", scr_w, scr_h, SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureBlendMode(present_tex, SDL_BLENDMODE_NONE);
+    SDL_SetTextureScaleMode(present_tex, SDL_SCALEMODE_NEAREST);
+    return true;
+}
+
+inline void free_present() {
+    if (present_tex) SDL_DestroyTexture(present_tex);
+    present_tex = nullptr;
+}
+
+// one composited pixel as RGBA32
+inline Uint32 present_pixel(const present_layers_t& layers, int i, float dist_scale) {
+#if defined(RC_X86) && defined(__SSE2__)
+    // one pixel per register: scale, clamp, truncate, pack to bytes
+    __m128 v;
+    if (layers.objects && buf_obj[i].color.a != 0)
+        v = _mm_mul_ps(_mm_loadu_ps(&buf_obj[i].color.r), _mm_set1_ps(255.0f));
+    else if (layers.light) {
+        SDL_FColor l = buf_light.at(i);
+        v = _mm_mul_ps(_mm_loadu_ps(&l.r), _mm_set1_ps(255.0f));
+    }
+    else if (layers.dist)
+        v = _mm_set1_ps(buf_dist[i] * dist_scale);
+    else
+        v = _mm_setzero_ps();
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    __m128i q = _mm_cvttps_epi32(v);
+    q = _mm_packs_epi32(q, q);
+    q = _mm_packus_epi16(q, q);
+    Uint32 c = static_cast<Uint32>(_mm_cvtsi128_si32(q)) | 0xff000000u;
+#else
+    float r = 0, g = 0, b = 0;
+    if (layers.objects && buf_obj[i].color.a != 0) {
+        const SDL_FColor& m = buf_obj[i].color;
+        r = m.r * 255.0f; g = m.g * 255.0f; b = m.b * 255.0f;
+    }
+    else if (layers.light) {
+        SDL_FColor l = buf_light.at(i);
+        r = l.r * 255.0f; g = l.g * 255.0f; b = l.b * 255.0f;
+    }
+    else if (layers.dist)
+        r = g = b = buf_dist[i] * dist_scale;
+    auto byte = [](float v) { return static_cast<Uint8>(v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v); };
+    Uint8  rgba[4] = {byte(r), byte(g), byte(b), 255};
+    Uint32 c;
+    memcpy(&c, rgba, 4);
+#endif
+    return c;
+}
+
+// Composites the layers into `pixels` (row-major RGBA32, `pitch` bytes per row).
+// The buffers run down columns (whole ones, or eight pixels of a tile), so
+// every tile is read down its columns into a row-major block first and then
+// copied out a whole row at a time; scattering single pixels one pitch apart
+// thrashes the cache sets.
+inline void fill_present(const present_layers_t& layers, Uint8* pixels, int pitch) {
+    const float dist_scale = 255.0f / diagonal;
+
+    pool.parallel_for(tile_count(scr_w, scr_h, tile_size), [&](int t, int) {
+        tile_t tile = tile_rect(t, scr_w, scr_h, tile_size);
+        int    tw = tile.x1 - tile.x0;
+        thread_local std::vector<Uint32> block;
+        block.resize(static_cast<size_t>(tile_size) * tile_size);
+
+        for (int x = tile.x0; x < tile.x1; ++x)
+            for (int y = tile.y0; y < tile.y1; ++y)
+                block[(y - tile.y0) * tw + (x - tile.x0)] = present_pixel(layers, px(x, y), dist_scale);
+        for (int y = tile.y0; y < tile.y1; ++y)
+            memcpy(pixels + static_cast<size_t>(y) * pitch + tile.x0 * 4, &block[(y - tile.y0) * tw], tw * 4);
+    });
+}
+
+// uploads the composited layers and copies them over the whole screen
+inline bool present_layers(SDL_Renderer* renderer, const present_layers_t& layers) {
+    if (!layers.dist && !layers.light && !layers.objects) return true;
+    void* pixels;
+    int   pitch;
+    if (!SDL_LockTexture(present_tex, nullptr, &pixels, &pitch)) return false;
+    fill_present(layers, static_cast<Uint8*>(pixels), pitch);
+    SDL_UnlockTexture(present_tex);
+
+    SDL_FRect dst = {0.0f, 0.0f, static_cast<float>(scr_w), static_cast<float>(scr_h)};
+    return SDL_RenderTexture(renderer, present_tex, nullptr, &dst);
+}
+
+// the same for layers fill_present() composited earlier into scr_w x scr_h
+// packed rows, e.g. on another thread
+inline bool present_image(SDL_Renderer* renderer, const Uint32* pixels) {
+    if (!SDL_UpdateTexture(present_tex, nullptr, pixels, scr_w * 4)) return false;
+    SDL_FRect dst = {0.0f, 0.0f, static_cast<float>(scr_w), static_cast<float>(scr_h)};
+    return SDL_RenderTexture(renderer, present_tex, nullptr, &dst);
+}
+
+#endif
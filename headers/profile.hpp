@@ -0,0 +1,150 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <SDL3/SDL.h>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Stage profiling. profile_scope_t times a block of the frame loop and, while
+// `profiling` is set, records it as an event of the current frame; otherwise
+// it costs a branch. Scopes open on the threads running the frame loop (the
+// viewer's solver and present threads when pipelined, see pipeline.hpp), the
+// workers are timed as part of the stage that started them.
+// Events go out as CSV or as Chrome trace events (chrome://tracing,
+// ui.perfetto.dev), frames and stages nesting like the scopes did.
+
+// marching done for one cascade in a frame; max_steps and hits are only
+// counted while profiling
+struct profile_counters_t {
+    long rays = 0;
+    long steps = 0;             // distance lookups
+    long max_steps = 0;         // of the longest ray
+    long hits = 0;              // rays that stopped on a surface
+};
+
+struct profile_event_t {
+    const char* name;
+    int    index;               // cascade or layer, -1 for none
+    int    frame;
+    int    thread;              // numbered in the order threads first record
+    Uint64 begin, end;
+    bool   counted;
+    profile_counters_t counters;
+};
+
+inline std::atomic<bool> profiling{false};
+inline thread_local int profile_frame = 0;     // the frame events of this thread belong to
+inline Uint64 profile_origin = 0;
+inline std::vector<profile_event_t> profile_events;
+inline std::mutex profile_mutex;                // guards profile_events
+inline std::atomic<int> profile_threads{0};
+inline thread_local int profile_thread = ++profile_threads;
+
+// starts a new recording, frames counting from 0 on the calling thread
+inline void profile_start() {
+    std::lock_guard<std::mutex> lk(profile_mutex);
+    profile_events.clear();
+    profile_frame  = 0;
+    profile_origin = SDL_GetPerformanceCounter();
+    profiling = true;
+}
+
+class profile_scope_t {
+public:
+    explicit profile_scope_t(const char* _name, int _index = -1)
+        : name(_name), index(_index), begin(profiling ? SDL_GetPerformanceCounter() : 0) {}
+    ~profile_scope_t() {
+        if (!begin || !profiling) return;
+        Uint64 end = SDL_GetPerformanceCounter();
+        std::lock_guard<std::mutex> lk(profile_mutex);
+        profile_events.push_back({name, index, profile_frame, profile_thread, begin, end, counted, counters});
+    }
+    profile_scope_t(const profile_scope_t&) = delete;
+    profile_scope_t& operator=(const profile_scope_t&) = delete;
+
+    void count(const profile_counters_t& c) {
+        counters = c;
+        counted  = true;
+    }
+
+private:
+    const char* name;
+    int    index;
+    Uint64 begin;
+    bool   counted = false;
+    profile_counters_t counters;
+};
+
+inline double profile_ms(Uint64 ticks) {
+    return static_cast<double>(ticks) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// "cascade 3", or just the name
+inline std::string profile_label(const profile_event_t& e) {
+    return e.index >= 0 ? std::string(e.name) + " " + std::to_string(e.index) : std::string(e.name);
+}
+
+// one line per event, counters left empty where there are none
+inline bool write_profile_csv(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "frame,stage,index,start_ms,ms,rays,steps,max_steps,hits,hit_ratio\n");
+    for (const profile_event_t& e : profile_events) {
+        fprintf(f, "%d,%s,%d,%.4f,%.4f", e.frame, e.name, e.index,
+                profile_ms(e.begin - profile_origin), profile_ms(e.end - e.begin));
+        const profile_counters_t& c = e.counters;
+        if (e.counted)
+            fprintf(f, ",%ld,%ld,%ld,%ld,%.4f\n", c.rays, c.steps, c.max_steps, c.hits,
+                    c.rays ? static_cast<double>(c.hits) / c.rays : 0.0);
+        else
+            fprintf(f, ",,,,,\n");
+    }
+    return fclose(f) == 0;
+}
+
+// Complete ("X") events in microseconds with the counters as args, plus a
+// counter track per cascade for its rays and lookups
+inline bool write_profile_trace(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    const char* sep = "";
+    for (const profile_event_t& e : profile_events) {
+        double ts = profile_ms(e.begin - profile_origin) * 1000.0, dur = profile_ms(e.end - e.begin) * 1000.0;
+        std::string label = profile_label(e);
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"args\":{\"frame\":%d",
+                sep, label.c_str(), e.name, e.thread, ts, dur, e.frame);
+        const profile_counters_t& c = e.counters;
+        if (e.counted)
+            fprintf(f, ",\"rays\":%ld,\"steps\":%ld,\"max_steps\":%ld,\"hits\":%ld", c.rays, c.steps, c.max_steps, c.hits);
+        fprintf(f, "}}");
+        if (e.counted)
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"rays\":%ld,\"steps\":%ld}}",
+                    label.c_str(), ts, c.rays, c.steps);
+        sep = ",\n";
+    }
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+// writes PREFIX.csv and PREFIX.json, reporting what went wrong
+inline bool write_profile(const std::string& prefix) {
+    std::lock_guard<std::mutex> lk(profile_mutex);
+    bool ok = true;
+    for (const char* ext : {".csv", ".json"}) {
+        std::string path = prefix + ext;
+        bool written = ext[1] == 'c' ? write_profile_csv(path) : write_profile_trace(path);
+        if (!written) {
+            fprintf(stderr, "Could not write \"%s\"\n", path.c_str());
+            ok = false;
+        }
+    }
+    if (ok) printf("Profile of %zu events written to %s.csv and %s.json\n", profile_events.size(), prefix.c_str(), prefix.c_str());
+    return ok;
+}
+
+#endif
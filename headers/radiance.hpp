@@ -0,0 +1,1479 @@
+#ifndef RADIANCE_H
+#define RADIANCE_H
+
+#include <SDL3/SDL.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "geometry.hpp"
+#include "bvh.hpp"
+#include "shape_store.hpp"
+#include "distance.hpp"
+#include "thread_pool.hpp"
+#include "march.hpp"
+#include "cascade_buffer.hpp"
+#include "hrc.hpp"
+#include "profile.hpp"
+
+// Radiance Cascades solver: scene -> buf_obj -> buf_dist -> buf_rc -> buf_light.
+// Shared by the interactive viewer and the headless renderer. With
+// SOLVER_HRC the lighting comes from the holographic solver in hrc.hpp
+// instead, traced over the same buf_dist.
+
+#define TAU     6.28319
+
+// scr_w, scr_h    - resolution of the per-pixel buffers, set before init_solver()
+inline int   scr_w = 512, scr_h = 512;
+inline float diagonal = std::sqrt(static_cast<float>(scr_w * scr_w + scr_h * scr_h));
+
+// d0              - distance b/w the probes in cascade 0
+// r0              - num of rays of a probe in cascade 0
+// rl0             - length of a ray in cascade 0
+inline int d0 = 64, r0 = 4, rl0 = 16;
+// s_res_factor    - spatial resolution factor
+// a_res_factor    - angular resolution factor
+// ray_len_factor  - ray length resolution factor
+inline int s_res_factor = 2, a_res_factor = 4, ray_len_factor = 3;
+inline int max_cascade = 1;
+// int d0 = 1, r0 = 4, rl0 = 2;
+// int s_res_factor = 2, a_res_factor = 4, ray_len_factor = 4;
+// int max_cascade = 5;
+
+inline int dist_mode = DIST_EDT;
+inline int march_simd = simd_detect();
+// march_mip - march over dist_mip, striding through blocks clear of surfaces
+inline bool march_mip = false;
+// march_cells - march over buf_cell, distance and material packed in 4 bytes
+inline bool march_cells = false;
+// cascade_format - how buf_rc/buf_merged store a ray, light_format - how
+// buf_light stores a pixel; one of color_formats, taken by init_solver()
+inline int cascade_format = COLOR_F32, light_format = COLOR_F32;
+// light_scale - gather buf_light for one pixel in every light_scale x
+//               light_scale block (up to 8) and upsample the rest, see
+//               upsample_light(); 1 gathers every pixel. Read every frame,
+//               so it can change from one to the next (classic cascades only).
+inline int light_scale = 1;
+
+// TRACER_SPHERE - sphere tracing through buf_dist
+// TRACER_DDA    - DDA through the occupancy bits of buf_obj, no distance field
+// TRACER_AUTO   - per cascade whichever traced it faster on the first full frame
+enum tracers {
+    TRACER_SPHERE,
+    TRACER_DDA,
+    TRACER_AUTO
+};
+inline int tracer_mode = TRACER_SPHERE;
+inline std::vector<int> cascade_tracer;     // TRACER_AUTO's choice per cascade, empty until made
+
+// SOLVER_RC  - classic cascades, buf_rc/buf_merged as configured above
+// SOLVER_HRC - holographic cascades, one probe every hrc_d0 pixels
+enum solvers {
+    SOLVER_RC,
+    SOLVER_HRC
+};
+inline int solver = SOLVER_RC;
+inline int hrc_d0 = 1;
+inline hrc_solver_t hrc;
+
+inline std::vector<std::unique_ptr<Object>> objects;
+inline object_bvh_t scene_bvh;     // index over objects, kept current by scene_changes()
+inline shape_store_t shape_store;  // SoA copy of the shape parameters, same upkeep
+
+// per-pixel buffers, laid out as pixel_index() says, index with px(x, y)
+inline std::vector<material_t> buf_obj;
+inline std::vector<float>      buf_dist;
+inline std::vector<uint32_t>   buf_cell;     // buf_dist and buf_obj packed, see pack_cell(); kept when march_cells is set
+inline color_buffer_t          buf_light;
+// one arena holds the traced levels 0..max_cascade followed by the merged ones
+inline cascade_arena_t cascade_arena;
+inline std::vector<cascade_view_t> buf_rc;      // traced rays, buf_rc[Cn].at(x, y)
+inline std::vector<cascade_view_t> buf_merged;  // rays merged with everything above, same shape
+inline std::vector<SDL_FColor> buf_fluence; // averaged cascade 0 probes, x-major
+inline std::vector<float>      buf_edt_cols; // squared distance along y, kept between frames for the EDT
+inline dist_pyramid_t          dist_mip;     // min pyramid of buf_dist, rebuilt with it when march_mip is set
+inline occupancy_t             occupancy;    // occupied pixels of buf_obj, kept current with it
+inline block_marks_t           drawn;        // blocks draw_object() wrote to, what the next clear has to undo
+inline material_palette_t      palette;      // materials buf_cell refers to, rebuilt with scene_bvh
+inline std::vector<uint32_t>   object_cell;  // palette index of every object, shifted into place
+inline bool                    dist_stale = false;  // buf_dist was skipped while only DDA traced
+inline std::atomic<long>       march_steps;  // distance lookups of all marching so far
+inline std::atomic<long>       march_max_steps, march_hits;  // of the cascade being counted, while profiling
+inline std::vector<int> cell_x, cell_y;     // first pixel of every gather cell, see gather_cascade0()
+inline int ray_w, ray_h;
+
+// n_threads  - workers for cascades and merging, 0 = all hardware threads
+// tile_size  - side of a square block of rays/pixels handed to one worker
+inline int n_threads = 0, tile_size = 32;
+inline bool deterministic = false;
+inline thread_pool pool(1);
+
+// wall time of each stage of the last compute(), in ms
+struct stage_times_t {
+    double obj = 0, dist = 0, merge = 0;
+    std::vector<double> cascade;    // per cascade, or per HRC level
+    rect_t dirty;               // pixels that were redone
+    long   rays = 0;            // rays that were traced
+    long   pending = 0;         // rays of amortised cascades still waiting, see refresh_pending()
+    long   steps = 0;           // distance lookups of those rays
+    std::vector<profile_counters_t> counters;   // per cascade, see count_cascade()
+};
+inline stage_times_t stage_times;
+
+// Change tracking. compute() compares every object with the state it had in
+// the previous frame and only redoes what the old and new footprints of the
+// changed ones can reach. Anything that is not an object edit (a new scene,
+// resolution or distance mode) calls invalidate_scene() for a full frame.
+struct object_state_t {
+    aabb_t     box;
+    vec2       centre;
+    material_t material;
+};
+inline std::vector<object_state_t> scene_state;
+inline bool scene_dirty  = true;    // redo everything on the next compute()
+inline bool merged_stale = true;    // buf_merged/buf_light are older than buf_rc (or the scene, for HRC)
+
+inline void invalidate_scene() {
+    scene_dirty = true;
+}
+
+// Rays of one cascade that have to be merged again: a flag per ray
+// (x * ray_h + y) and the list of flagged ones, so clearing costs what was set.
+struct ray_set_t {
+    std::vector<uint8_t> flag;
+    std::vector<int>     list;
+
+    void reset(size_t n) { flag.assign(n, 0); list.clear(); }
+    void add(int i) {
+        if (flag[i]) return;
+        flag[i] = 1;
+        list.push_back(i);
+    }
+    void clear() {
+        for (int i : list) flag[i] = 0;
+        list.clear();
+    }
+    // drops the rays f(i) is true for, keeping the order of the others
+    template <class F>
+    void remove_if(F f) {
+        size_t n = 0;
+        for (int i : list) {
+            if (f(i)) flag[i] = 0;
+            else      list[n++] = i;
+        }
+        list.resize(n);
+    }
+};
+inline std::vector<ray_set_t> dirty_rays;
+
+// Temporal amortisation. The rays an edit reaches in a cascade with period
+// k > 1 are not traced right away but wait in pending_rays, keeping their
+// old value meanwhile. Each frame traces the pending rays of every k-th
+// probe, the subset rotating with the frame, so a moving object costs such
+// a cascade about 1/k of its rays per frame.
+// ray_budget   - most rays the amortised cascades trace in one frame, 0 = all
+//                that are due; lower cascades are served first
+// history_blend - share of the old value a refreshed ray keeps; the ray
+//                stays pending until it is within history_eps of its trace
+inline std::vector<int> cascade_period;     // k per cascade, missing ones are 1
+inline long  ray_budget = 0;
+inline float history_blend = 0.0f, history_eps = 1.0f / 512;
+inline std::vector<ray_set_t> pending_rays;
+inline unsigned amortise_frame = 0;
+
+inline int period(int Cn) {
+    return Cn < static_cast<int>(cascade_period.size()) ? std::max(cascade_period[Cn], 1) : 1;
+}
+
+inline int px(int x, int y) {
+    return pixel_index(x, y, scr_h);
+}
+
+inline double ms_since(Uint64 start) {
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+inline march_field_t march_field() {
+    march_field_t f = {buf_dist.data(), buf_obj.data(), scr_w, scr_h, march_mip ? &dist_mip : nullptr, &march_steps};
+    if (profiling) f.max_steps = &march_max_steps;
+    if (march_cells) {
+        f.cell    = buf_cell.data();
+        f.palette = palette.entries.data();
+    }
+    return f;
+}
+
+inline int tracer(int Cn) {
+    if (tracer_mode != TRACER_AUTO) return tracer_mode;
+    return Cn < static_cast<int>(cascade_tracer.size()) ? cascade_tracer[Cn] : TRACER_SPHERE;
+}
+
+// the field cascade Cn is traced through
+inline march_field_t march_field(int Cn) {
+    march_field_t f = march_field();
+    if (tracer(Cn) == TRACER_DDA) f.occ = &occupancy;
+    return f;
+}
+
+// HRC and every sphere traced cascade read buf_dist
+inline bool needs_dist() {
+    if (solver == SOLVER_HRC) return true;
+    for (int Cn = 0; Cn <= max_cascade; ++Cn)
+        if (tracer(Cn) == TRACER_SPHERE) return true;
+    return false;
+}
+
+inline SDL_FColor ray_march(vec2 r_orig, vec2 r_dir, float r_len) {
+    return march_ray(march_field(), r_orig, r_dir, r_len);
+}
+
+inline rect_t screen_rect() {
+    return {0, 0, scr_w, scr_h};
+}
+
+// palette index of object i for buf_cell; past 65535 materials the cells
+// cannot tell them apart and march_cells is turned off
+inline void assign_cell(size_t i) {
+    int m = palette.find(objects[i]->material);
+    if (m < 0) {
+        fprintf(stderr, "More than 65535 materials, not packing cells\n");
+        march_cells = false;
+        return;
+    }
+    object_cell[i] = static_cast<uint32_t>(m) << 16;
+}
+
+// pixels covered by objects that changed since the last call, the whole
+// screen after invalidate_scene() or when objects were added/removed.
+// Rebuilds scene_bvh and shape_store (and the palette) in the latter case
+// and refreshes what changed otherwise.
+inline rect_t scene_changes() {
+    auto same = [](const material_t& a, const material_t& b) {
+        return a.color.r == b.color.r && a.color.g == b.color.g && a.color.b == b.color.b &&
+               a.color.a == b.color.a && a.emissivity == b.emissivity;
+    };
+    bool   full = scene_dirty || scene_state.size() != objects.size();
+    rect_t dirty;
+    scene_state.resize(objects.size());
+    for (size_t i = 0; i < objects.size(); ++i) {
+        object_state_t  now = {objects[i]->aabb(), objects[i]->centre, objects[i]->material};
+        object_state_t& was = scene_state[i];
+        bool moved = !(now.box.lo == was.box.lo) || !(now.box.hi == was.box.hi);
+        if (moved || !(now.centre == was.centre) || !same(now.material, was.material)) {
+            dirty.add(was.box.pixels().clip(screen_rect()));
+            dirty.add(now.box.pixels().clip(screen_rect()));
+            if (moved && !full) scene_bvh.refit(objects, i);
+            if (!full) shape_store.update(objects, i);
+            if (!full && march_cells && !same(now.material, was.material)) assign_cell(i);
+        }
+        was = now;
+    }
+    if (full) {
+        scene_bvh.build(objects);
+        shape_store.build(objects);
+        if (march_cells) {
+            palette.clear();
+            object_cell.assign(objects.size(), 0);
+            for (size_t i = 0; i < objects.size() && march_cells; ++i) assign_cell(i);
+        }
+    }
+    return full ? screen_rect() : dirty;
+}
+
+// object under p, the first in scene order, -1 for none
+inline int pick_object(vec2 p) {
+    return scene_bvh.pick(objects, p);
+}
+
+// moves object i and refits scene_bvh right away, so later picks see it
+inline void move_object(int i, vec2 centre) {
+    objects[i]->centre = centre;
+    scene_bvh.refit(objects, i);
+    shape_store.update(objects, i);
+}
+
+// Rasterises object i into buf_obj inside clip, without a virtual sdf() call
+// per pixel. Boxes up to DRAW_SPAN_MIN pixels high get the sdf of every
+// pixel, 4 at a time, taller ones the runs of covered pixels the shape store
+// brackets analytically column by column. Either way the box is marked in
+// `drawn`.
+const int DRAW_SPAN_MIN = 32;
+
+inline void draw_object(int i, const rect_t& clip) {
+    rect_t r = objects[i]->bounds().clip(clip).clip(screen_rect());
+    if (r.empty()) return;
+    drawn.set(r);
+    // copies, so the stores below cannot alias them
+    const material_t m = objects[i]->material;
+    material_t* obj   = buf_obj.data();
+    uint32_t*   cells = march_cells ? buf_cell.data() : nullptr;
+    uint32_t    cell  = cells ? object_cell[i] : 0;
+    if (r.y1 - r.y0 > DRAW_SPAN_MIN) {
+        shape_store.rasterise(i, r, [&](int x, int y0, int y1) {
+            for (int y = y0; y < y1; ++y) obj[px(x, y)] = m;
+            if (cells)
+                for (int y = y0; y < y1; ++y) cells[px(x, y)] = cell;
+        });
+        return;
+    }
+    static std::vector<float> d;
+    int stride = (r.y1 - r.y0 + 3) & ~3;
+    d.resize(static_cast<size_t>(r.x1 - r.x0) * stride);
+    shape_store.sdf_block(i, r, stride, d.data());
+    for (int x = r.x0; x < r.x1; ++x) {
+        const float* dist = &d[(x - r.x0) * stride];
+        for (int y = 0; y < r.y1 - r.y0; ++y)
+            if (dist[y] <= 0) obj[px(x, r.y0 + y)] = m;
+    }
+    if (!cells) return;
+    for (int x = r.x0; x < r.x1; ++x) {
+        const float* dist = &d[(x - r.x0) * stride];
+        for (int y = 0; y < r.y1 - r.y0; ++y)
+            if (dist[y] <= 0) cells[px(x, r.y0 + y)] = cell;
+    }
+}
+
+// clears what earlier draws left in r and redraws the objects scene_bvh
+// finds reaching into it, in scene order so overlaps resolve exactly as in a
+// full redraw. Only blocks drawn to are cleared, the rest of r already is.
+inline void fill_buf_obj(const rect_t& r) {
+    bool cells = march_cells;
+    drawn.take(r, [&](const rect_t& part) {
+        for (int x = part.x0; x < part.x1; ++x)
+            for (int y = part.y0; y < part.y1; ++y) buf_obj[px(x, y)] = material_t({0,0,0,0},0);
+        if (cells)
+            for (int x = part.x0; x < part.x1; ++x)
+                for (int y = part.y0; y < part.y1; ++y) buf_cell[px(x, y)] = 0;
+    });
+    // a full redraw touches everything anyway, skip the query and its sort
+    static std::vector<int> candidates;
+    if (r == screen_rect()) {
+        candidates.resize(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i) candidates[i] = static_cast<int>(i);
+    }
+    else
+        scene_bvh.query(aabb_t(r), candidates);
+    for (int i : candidates)
+        if (!objects[i]->bounds().clip(r).empty())
+            draw_object(i, r);
+}
+inline void fill_buf_obj() {
+    fill_buf_obj(screen_rect());
+}
+// Per block of the tile: the object nearest the block centre bounds the
+// distance anywhere in the block by d + h (h the half diagonal), so only
+// objects whose box comes that close can matter. Those are copied into a
+// small store and swept 4 at a time for every pixel of the block.
+const int ANALYTIC_BLOCK = 8;
+
+inline void fill_buf_dist_analytic() {
+    pool.parallel_for(tile_count(scr_w, scr_h, tile_size), [&](int t, int) {
+        tile_t tile = tile_rect(t, scr_w, scr_h, tile_size);
+        thread_local std::vector<int> candidates;
+        thread_local shape_store_t    near;
+        for (int bx = tile.x0; bx < tile.x1; bx += ANALYTIC_BLOCK) {
+            for (int by = tile.y0; by < tile.y1; by += ANALYTIC_BLOCK) {
+                int   ex = std::min(bx + ANALYTIC_BLOCK, tile.x1), ey = std::min(by + ANALYTIC_BLOCK, tile.y1);
+                vec2  lo(bx, by), hi(ex - 1, ey - 1);
+                float h = (hi - lo).length() * 0.5f;
+                float reach = std::max(scene_bvh.nearest(objects, (lo + hi) * 0.5f, diagonal) + h, 0.0f) + 1.0f;
+                scene_bvh.query({lo - vec2(reach), hi + vec2(reach)}, candidates);
+                near.clear();
+                for (int i : candidates) near.add(shape_store, i);
+
+                for (int x = bx; x < ex; ++x) {
+                    for (int y = by; y < ey; ++y) {
+                        float min = near.min_sdf(static_cast<float>(x), static_cast<float>(y), diagonal);
+                        if (min < 0) min = 0;
+                        buf_dist[px(x, y)] = min;
+                    }
+                }
+            }
+        }
+    });
+}
+// column pass for the columns of r only, the row pass always covers everything
+inline void fill_buf_dist_edt(const rect_t& r) {
+    int n = std::max(scr_w, scr_h), band = tile_size;
+    auto scratch = [n](std::vector<float>& f, std::vector<float>& d, std::vector<int>& v, std::vector<float>& z) {
+        f.resize(EDT_ROW_BLOCK * n); d.resize(EDT_ROW_BLOCK * n); v.resize(n); z.resize(n + 1);
+    };
+
+    pool.parallel_for((r.x1 - r.x0 + band - 1) / band, [&](int t, int) {
+        thread_local std::vector<float> f, d, z;
+        thread_local std::vector<int>   v;
+        scratch(f, d, v, z);
+        int x0 = r.x0 + t * band;
+        edt_columns(buf_obj.data(), buf_edt_cols.data(), scr_h, x0, std::min(x0 + band, r.x1), f.data(), v.data(), z.data());
+    });
+    pool.parallel_for((scr_h + band - 1) / band, [&](int t, int) {
+        thread_local std::vector<float> f, d, z;
+        thread_local std::vector<int>   v;
+        scratch(f, d, v, z);
+        int y0 = t * band;
+        edt_rows(buf_edt_cols.data(), buf_dist.data(), scr_w, scr_h, y0, std::min(y0 + band, scr_h), diagonal,
+                 f.data(), d.data(), v.data(), z.data());
+    });
+}
+inline void fill_buf_dist_edt() {
+    fill_buf_dist_edt(screen_rect());
+}
+// every level from the one below, a band of columns per task
+inline void fill_dist_mip() {
+    for (int L = 1; L <= dist_mip.top; ++L) {
+        int w = dist_mip.width(L), band = std::max(1, tile_size / 4);
+        pool.parallel_for((w + band - 1) / band, [&](int t, int) {
+            dist_mip.reduce(L, buf_dist.data(), t * band, std::min(w, (t + 1) * band));
+        });
+    }
+}
+
+// packs buf_dist into the low half of buf_cell, the material half is
+// written by draw_object(). Every row of the EDT may change, so all of it.
+inline void fill_buf_cell() {
+    size_t n = buf_cell.size(), band = 1 << 16;
+    pool.parallel_for(static_cast<int>((n + band - 1) / band), [&](int t, int) {
+        size_t end = std::min(n, (t + 1) * band);
+        for (size_t i = t * band; i < end; ++i)
+            buf_cell[i] = (buf_cell[i] & 0xffff0000u) | cell_distance_bits(buf_dist[i]);
+    });
+}
+
+// every distance may change with any object, only the EDT can reuse columns
+inline void fill_buf_dist(const rect_t& r) {
+    if (dist_mode == DIST_ANALYTIC) fill_buf_dist_analytic();
+    else                            fill_buf_dist_edt(r);
+    if (march_mip) fill_dist_mip();
+    if (march_cells) fill_buf_cell();
+}
+inline void fill_buf_dist() {
+    fill_buf_dist(screen_rect());
+}
+
+// times both distance builders on the current buf_obj and reports how far
+// the EDT field is from the analytic reference
+inline void compare_dist_modes() {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    fill_buf_dist_analytic();
+    double t_analytic = ms_since(t0);
+    std::vector<float> ref = buf_dist;
+    t0 = SDL_GetPerformanceCounter();
+    fill_buf_dist_edt();
+    double t_edt = ms_since(t0);
+
+    double max_err = 0, sum_err = 0;
+    for (size_t i = 0; i < ref.size(); ++i) {
+        double err = std::abs(buf_dist[i] - ref[i]);
+        sum_err += err;
+        if (err > max_err) max_err = err;
+    }
+    printf("dist analytic: %.3f ms | edt: %.3f ms | max err %.3f px | mean err %.3f px\n",
+           t_analytic, t_edt, max_err, sum_err / ref.size());
+
+    fill_buf_dist();
+}
+
+// Bilinear footprint of a point over a grid of probes spaced dn apart with
+// centres at (i + 0.5) * dn. Clamped at the borders, so one probe is enough.
+struct probe_bilinear_t {
+    int x0, y0, x1, y1;
+    float tx, ty;
+};
+
+// one axis of the footprint: probes i0, i1 and the weight t of i1
+struct probe_axis_t {
+    int i0, i1;
+    float t;
+};
+
+inline probe_axis_t probe_axis(float p, int dn, int n) {
+    float f = p / dn - 0.5f;
+    probe_axis_t a;
+    a.i0 = static_cast<int>(std::floor(f));
+    a.t  = f - a.i0;
+    if (a.i0 < 0)      { a.i0 = 0;     a.t = 0.0f; }
+    if (a.i0 >= n - 1) { a.i0 = n - 1; a.t = 0.0f; }
+    a.i1 = a.i0 + 1 < n ? a.i0 + 1 : a.i0;
+    return a;
+}
+
+inline probe_bilinear_t probe_bilinear(probe_axis_t ax, probe_axis_t ay) {
+    return {ax.i0, ay.i0, ax.i1, ay.i1, ax.t, ay.t};
+}
+
+inline probe_bilinear_t probe_bilinear(vec2 p, int dn, int probes_w, int probes_h) {
+    return probe_bilinear(probe_axis(p.x, dn, probes_w), probe_axis(p.y, dn, probes_h));
+}
+
+inline SDL_FColor blend(const probe_bilinear_t& b, SDL_FColor c00, SDL_FColor c10, SDL_FColor c01, SDL_FColor c11) {
+    float w00 = (1 - b.tx) * (1 - b.ty), w10 = b.tx * (1 - b.ty);
+    float w01 = (1 - b.tx) * b.ty,       w11 = b.tx * b.ty;
+    return {c00.r * w00 + c10.r * w10 + c01.r * w01 + c11.r * w11,
+            c00.g * w00 + c10.g * w10 + c01.g * w01 + c11.g * w11,
+            c00.b * w00 + c10.b * w10 + c01.b * w01 + c11.b * w11,
+            c00.a * w00 + c10.a * w10 + c01.a * w01 + c11.a * w11};
+}
+
+// Everything about cascade Cn that stays the same from frame to frame. Built
+// once by init_solver(), so the per-ray loops never call pow, sqrt, cos or sin.
+struct cascade_desc_t {
+    int   rn, dn;                   // rays per probe side, probe spacing
+    int   rn_log2;                  // log2(rn) when rn is a power of two, else -1
+    int   probes_w, probes_h;
+    int   cover_w, cover_h;         // probes including the partial ones at the right/bottom edge
+    float r_start, r_len;           // interval covered by every ray
+    std::vector<vec2>  dir;         // direction of ray r = rx + ry * rn
+    std::vector<vec2>  start;       // dir * r_start, ray origin relative to its probe centre
+    // indexed by probe, including the partial probe at the right/bottom edge
+    std::vector<float> centre;      // probe centre along either axis, (i + 0.5) * dn
+    std::vector<probe_axis_t> up_x, up_y;   // probe footprints over cascade Cn+1
+    // the inverse: for every whole probe of Cn+1, the probes [x0, x1) of Cn reading it
+    std::vector<int> read_x0, read_x1, read_y0, read_y1;
+};
+inline std::vector<cascade_desc_t> cascade_desc;
+
+inline cascade_desc_t make_cascade_desc(int Cn) {
+    cascade_desc_t c;
+    c.rn = sqrt(r0 * pow(a_res_factor, Cn));
+    c.dn = d0 * pow(s_res_factor, Cn);
+    c.rn_log2 = -1;
+    for (int k = 0; (1 << k) <= c.rn; ++k)
+        if ((1 << k) == c.rn) c.rn_log2 = k;
+    c.probes_w = ray_w / c.rn;
+    c.probes_h = ray_h / c.rn;
+    c.r_start = rl0 * (1 - pow(ray_len_factor, Cn)) / (1 - ray_len_factor);
+    c.r_len   = rl0 * pow(ray_len_factor, Cn);
+
+    for (int r = 0; r < c.rn * c.rn; ++r) {
+        float r_ang = TAU * (r + 0.5) / (c.rn * c.rn);
+        vec2  r_dir = vec2(cos(r_ang), sin(r_ang));
+        c.dir.push_back(r_dir);
+        c.start.push_back(r_dir * c.r_start);
+    }
+    c.cover_w = (ray_w + c.rn - 1) / c.rn;
+    c.cover_h = (ray_h + c.rn - 1) / c.rn;
+    for (int i = 0; i < std::max(c.cover_w, c.cover_h); ++i)
+        c.centre.push_back(i * static_cast<float>(c.dn) + c.dn * 0.5f);
+
+    if (Cn < max_cascade) {
+        int rn_up = sqrt(r0 * pow(a_res_factor, Cn + 1));
+        int dn_up = d0 * pow(s_res_factor, Cn + 1);
+        for (int i = 0; i < c.cover_w; ++i) c.up_x.push_back(probe_axis(c.centre[i], dn_up, ray_w / rn_up));
+        for (int j = 0; j < c.cover_h; ++j) c.up_y.push_back(probe_axis(c.centre[j], dn_up, ray_h / rn_up));
+
+        auto invert = [](const std::vector<probe_axis_t>& up, int n_up, std::vector<int>& lo, std::vector<int>& hi) {
+            lo.assign(n_up, static_cast<int>(up.size()));
+            hi.assign(n_up, 0);
+            for (int i = 0; i < static_cast<int>(up.size()); ++i)
+                for (int p : {up[i].i0, up[i].i1}) {
+                    lo[p] = std::min(lo[p], i);
+                    hi[p] = std::max(hi[p], i + 1);
+                }
+        };
+        invert(c.up_x, ray_w / rn_up, c.read_x0, c.read_x1);
+        invert(c.up_y, ray_h / rn_up, c.read_y0, c.read_y1);
+    }
+    return c;
+}
+
+// Compile-time cascade config for the hot loops. R0 = 0 reads r0 and
+// a_res_factor at run time; the configs we ship get their own instances, where
+// the per-ray loops unroll and probe/ray splits become shifts and masks.
+template <int R0, int A, int S>
+struct cascade_cfg_t {
+    static constexpr bool fixed = R0 > 0;
+    // rn is a power of two on every cascade when r0 and a are powers of four
+    static constexpr bool pow2 = fixed && (R0 & (R0 - 1)) == 0 && (R0 & 0x55555555) != 0
+                                       && (A & (A - 1)) == 0 && (A & 0x55555555) != 0;
+    static_assert(!fixed || A == S * S, "every cascade must hold the same number of rays");
+
+    static int r0() { return fixed ? R0 : ::r0; }
+    static int a()  { return fixed ? A : a_res_factor; }
+
+    // splits a ray coordinate into its probe and the ray within the probe
+    static int probe(int x, const cascade_desc_t& c) { return pow2 ? x >> c.rn_log2 : x / c.rn; }
+    static int ray(int x, const cascade_desc_t& c)   { return pow2 ? x & (c.rn - 1) : x % c.rn; }
+};
+
+inline bool cascade_config_is(int R0, int A, int S) {
+    return r0 == R0 && a_res_factor == A && s_res_factor == S;
+}
+
+// the top cascade has nothing above it, its merged radiance is the traced one
+inline const cascade_view_t& merged_cascade(int Cn) {
+    return Cn == max_cascade ? buf_rc[Cn] : buf_merged[Cn];
+}
+
+// Folds the merged cascade Cn+1 into cascade Cn, once per probe and ray: every
+// ray that escapes its own interval continues with the bilinearly interpolated
+// average of the a_res_factor rays of Cn+1 that cover the same angles.
+// With `rays` only those are merged, otherwise the whole cascade. F is
+// cascade_format, so the per-ray loads and stores know their encoding.
+template <int R0, int A, int S, int F>
+inline void merge_cascade_t(int Cn, const ray_set_t* rays) {
+    using cfg = cascade_cfg_t<R0, A, S>;
+    const cascade_desc_t& c  = cascade_desc[Cn];
+    const cascade_desc_t& up = cascade_desc[Cn + 1];
+    const int a = cfg::a();
+
+    const cascade_view_t& raw   = buf_rc[Cn];
+    const cascade_view_t& upper = merged_cascade(Cn + 1);
+    const cascade_view_t& out   = buf_merged[Cn];
+
+    auto merge_ray = [&](int x, int y) {
+        SDL_FColor own = raw.get<F>(x, y);
+        if (own.a == 0.0) { // hit something inside its own interval
+            out.put<F>(x, y, own);
+            return;
+        }
+
+        int i = cfg::probe(x, c), rx = cfg::ray(x, c);
+        int j = cfg::probe(y, c), ry = cfg::ray(y, c);
+        probe_bilinear_t b = probe_bilinear(c.up_x[i], c.up_y[j]);
+        int r = rx + ry * c.rn;
+
+        float sum_rad[4] = {0.0, 0.0, 0.0, 0.0};
+        for (int k = 0; k < a; ++k) {
+            int R   = r * a + k;
+            int urx = cfg::ray(R, up), ury = cfg::probe(R, up);
+            SDL_FColor above = blend(b, upper.get<F>(b.x0 * up.rn + urx, b.y0 * up.rn + ury),
+                                      upper.get<F>(b.x1 * up.rn + urx, b.y0 * up.rn + ury),
+                                      upper.get<F>(b.x0 * up.rn + urx, b.y1 * up.rn + ury),
+                                      upper.get<F>(b.x1 * up.rn + urx, b.y1 * up.rn + ury));
+            sum_rad[0] += above.r;
+            sum_rad[1] += above.g;
+            sum_rad[2] += above.b;
+            sum_rad[3] += above.a;
+        }
+        out.put<F>(x, y, {own.r + own.a * (sum_rad[0] / a),
+                       own.g + own.a * (sum_rad[1] / a),
+                       own.b + own.a * (sum_rad[2] / a),
+                       own.a * sum_rad[3] / a});
+    };
+
+    if (rays) {
+        const std::vector<int>& list = rays->list;
+        int chunk = tile_size * tile_size;
+        pool.parallel_for((static_cast<int>(list.size()) + chunk - 1) / chunk, [&](int t, int) {
+            int end = std::min(static_cast<int>(list.size()), (t + 1) * chunk);
+            for (int k = t * chunk; k < end; ++k)
+                merge_ray(list[k] / ray_h, list[k] % ray_h);
+        });
+        return;
+    }
+
+    pool.parallel_for(tile_count(ray_w, ray_h, tile_size), [&](int t, int) {
+        tile_t tile = tile_rect(t, ray_w, ray_h, tile_size);
+        for (int x = tile.x0; x < tile.x1; ++x)
+        for (int y = tile.y0; y < tile.y1; ++y)
+            merge_ray(x, y);
+    });
+}
+
+template <int R0, int A, int S>
+inline void merge_cascade_f(int Cn, const ray_set_t* rays) {
+    switch (cascade_format) {
+        case COLOR_F16:    merge_cascade_t<R0, A, S, COLOR_F16>(Cn, rays); break;
+        case COLOR_RGB9E5: merge_cascade_t<R0, A, S, COLOR_RGB9E5>(Cn, rays); break;
+        default:           merge_cascade_t<R0, A, S, COLOR_F32>(Cn, rays);
+    }
+}
+
+inline void merge_cascade(int Cn, const ray_set_t* rays = nullptr) {
+    if      (cascade_config_is(4, 4, 2))  merge_cascade_f<4, 4, 2>(Cn, rays);
+    else if (cascade_config_is(16, 4, 2)) merge_cascade_f<16, 4, 2>(Cn, rays);
+    else                                  merge_cascade_f<0, 0, 0>(Cn, rays);
+}
+
+// Adds to `rays` every ray of cascade Cn whose merge reads one of the merged
+// rays `upper` of Cn+1: the ray whose angles they refine, at every probe that
+// has their probe in its bilinear footprint. Rays that stop inside their own
+// interval never read the cascade above and are left out.
+inline void add_readers(int Cn, const ray_set_t& upper, ray_set_t& rays) {
+    const cascade_desc_t& c  = cascade_desc[Cn];
+    const cascade_desc_t& up = cascade_desc[Cn + 1];
+    const cascade_view_t& raw = buf_rc[Cn];
+
+    for (int idx : upper.list) {
+        int X = idx / ray_h, Y = idx % ray_h;
+        int P = X / up.rn, Q = Y / up.rn;
+        if (P >= static_cast<int>(c.read_x0.size()) || Q >= static_cast<int>(c.read_y0.size()))
+            continue;   // partial probes at the edge are never read
+        int r  = (X % up.rn + (Y % up.rn) * up.rn) / a_res_factor;
+        int rx = r % c.rn, ry = r / c.rn;
+        for (int i = c.read_x0[P]; i < c.read_x1[P]; ++i) {
+            int x = i * c.rn + rx;
+            if (x >= ray_w) continue;
+            for (int j = c.read_y0[Q]; j < c.read_y1[Q]; ++j) {
+                int y = j * c.rn + ry;
+                if (y < ray_h && raw.at(x, y).a != 0.0) rays.add(x * ray_h + y);
+            }
+        }
+    }
+}
+
+// buf_light's value at pixel (x, y), interpolated from buf_fluence
+inline SDL_FColor gather_pixel(int x, int y) {
+    const cascade_desc_t& c = cascade_desc[0];
+    int probes_h = c.probes_h;
+    probe_bilinear_t b = probe_bilinear(vec2(x, y), d0, c.probes_w, probes_h);
+    return blend(b, buf_fluence[b.x0 * probes_h + b.y0], buf_fluence[b.x1 * probes_h + b.y0],
+                    buf_fluence[b.x0 * probes_h + b.y1], buf_fluence[b.x1 * probes_h + b.y1]);
+}
+
+// Reduced gather. With light_scale k > 1 only the anchor pixels, one in the
+// middle of every k x k block, are gathered into buf_light_low and the pixels
+// between four anchors blend them, bilinear like the probes. That would blur
+// the lighting across the edges of objects, so the cells of anchors with an
+// occupied pixel among them (light_edge) gather all their pixels instead;
+// there gather_pixel() costs about what testing the anchors would, and the
+// edges come out exactly as at full resolution. The rest blend the anchors
+// along x once per column, which is cheaper per pixel than gather_pixel().
+inline std::vector<SDL_FColor>   buf_light_low;          // anchors, x-major
+inline std::vector<int>          anchor_x, anchor_y;     // pixel column/row of every anchor column/row
+inline std::vector<probe_axis_t> light_up_x, light_up_y; // the anchors every pixel column/row lies between
+inline std::vector<uint8_t>      light_edge;             // per anchor cell, whether its pixels are gathered
+inline int light_axes_scale = 0;    // light_step() the above were made for, 0 for none
+inline int gathered_scale   = 0;    // light_step() buf_light was last gathered at, 0 for none
+
+// light_scale as used, 1 to 8
+inline int light_step() {
+    return std::clamp(light_scale, 1, 8);
+}
+
+inline void make_light_axes(int k) {
+    auto axis = [k](int n, std::vector<int>& anchor, std::vector<probe_axis_t>& up) {
+        int m = (n + k - 1) / k;
+        anchor.resize(m);
+        for (int i = 0; i < m; ++i) anchor[i] = std::min(i * k + k / 2, n - 1);
+        up.resize(n);
+        for (int p = 0, i = 0; p < n; ++p) {
+            while (i + 1 < m && anchor[i + 1] <= p) ++i;
+            probe_axis_t& a = up[p];
+            a.i0 = i;
+            a.i1 = std::min(i + 1, m - 1);
+            a.t  = p <= anchor[i] || a.i1 == i ? 0.0f
+                                               : static_cast<float>(p - anchor[i]) / (anchor[a.i1] - anchor[i]);
+        }
+    };
+    axis(scr_w, anchor_x, light_up_x);
+    axis(scr_h, anchor_y, light_up_y);
+    buf_light_low.assign(anchor_x.size() * anchor_y.size(), {0.0, 0.0, 0.0, 1.0});
+    light_edge.assign(anchor_x.size() * anchor_y.size(), 0);
+    light_axes_scale = k;
+}
+
+// the pixels from anchor i to anchor i + 1 of an axis, the ends of the screen
+// for the first and last anchor
+inline void anchor_span(const std::vector<int>& anchor, int n, int i, int& lo, int& hi) {
+    lo = i == 0 ? 0 : anchor[i];
+    hi = i + 1 < static_cast<int>(anchor.size()) ? anchor[i + 1] + 1 : n;
+}
+
+// gathers the anchors in r and upsamples the pixels in `up`
+inline void upsample_light(const rect_t& r, const rect_t& up) {
+    int lw = static_cast<int>(anchor_x.size()), lh = static_cast<int>(anchor_y.size());
+    if (!r.empty()) {
+        int i0 = light_up_x[r.x0].i0, i1 = light_up_x[r.x1 - 1].i1, j0 = light_up_y[r.y0].i0, j1 = light_up_y[r.y1 - 1].i1;
+        pool.parallel_for(i1 - i0 + 1, [&](int t, int) {
+            for (int j = j0; j <= j1; ++j) buf_light_low[(i0 + t) * lh + j] = gather_pixel(anchor_x[i0 + t], anchor_y[j]);
+        });
+    }
+    if (up.empty()) return;
+    // the cells around `up` with an occupied pixel between their anchors
+    int ci0 = light_up_x[up.x0].i0, ci1 = std::min(light_up_x[up.x1 - 1].i0 + 1, lw);
+    int cj0 = light_up_y[up.y0].i0, cj1 = std::min(light_up_y[up.y1 - 1].i0 + 1, lh);
+    pool.parallel_for(ci1 - ci0, [&](int t, int) {
+        int i = ci0 + t, x0, x1;
+        anchor_span(anchor_x, scr_w, i, x0, x1);
+        for (int j = cj0; j < cj1; ++j) {
+            int y0, y1;
+            anchor_span(anchor_y, scr_h, j, y0, y1);
+            light_edge[i * lh + j] = occupancy.any({x0, y0, x1, y1});
+        }
+    });
+    // a column at a time: the anchor rows blended along x, then the pixels
+    // along y
+    int uw = up.x1 - up.x0, uh = up.y1 - up.y0;
+    pool.parallel_for(tile_count(uw, uh, tile_size), [&](int t, int) {
+        tile_t tile = tile_rect(t, uw, uh, tile_size);
+        int y0 = up.y0 + tile.y0, y1 = up.y0 + tile.y1;
+        int j0 = light_up_y[y0].i0, j1 = light_up_y[y1 - 1].i1;
+        const probe_axis_t* axis_y = light_up_y.data();
+        std::vector<SDL_FColor> col(j1 - j0 + 1);
+        for (int x = up.x0 + tile.x0; x < up.x0 + tile.x1; ++x) {
+            probe_axis_t ax = light_up_x[x];
+            const SDL_FColor* a = &buf_light_low[ax.i0 * lh];
+            const SDL_FColor* b = &buf_light_low[ax.i1 * lh];
+            for (int j = j0; j <= j1; ++j)
+                col[j - j0] = {a[j].r + (b[j].r - a[j].r) * ax.t, a[j].g + (b[j].g - a[j].g) * ax.t,
+                               a[j].b + (b[j].b - a[j].b) * ax.t, 1.0};
+            // 8 rows at a time, which lie next to each other in buf_light
+            const uint8_t* edge = &light_edge[ax.i0 * lh];
+            for (int y = y0; y < y1;) {
+                int ye = std::min((y | 7) + 1, y1);
+                SDL_FColor v[8];
+                for (int yy = y; yy < ye; ++yy) {
+                    probe_axis_t ay = axis_y[yy];
+                    if (edge[ay.i0]) {
+                        v[yy - y] = gather_pixel(x, yy);
+                        continue;
+                    }
+                    const SDL_FColor& c = col[ay.i0 - j0];
+                    const SDL_FColor& d = col[ay.i1 - j0];
+                    v[yy - y] = {c.r + (d.r - c.r) * ay.t, c.g + (d.g - c.g) * ay.t, c.b + (d.b - c.b) * ay.t, 1.0};
+                }
+                buf_light.set(px(x, y), v, ye - y);
+                y = ye;
+            }
+        }
+    });
+}
+
+// Averages the r0 merged rays of every cascade 0 probe, then interpolates
+// those per-probe values for every pixel of buf_light. With `rays` only the
+// probes holding one of them are averaged again, and only the pixels
+// interpolating between those probes are redone; `edited` are the pixels
+// whose objects changed, which the reduced gather's edges depend on.
+//
+// Pixels are grouped into cells, cell k of an axis being the pixels between
+// the centres of probes k and k+1 (cell_x[k] <= x < cell_x[k+1]).
+inline void gather_cascade0(const ray_set_t* rays = nullptr, const rect_t& edited = {}) {
+    const cascade_desc_t& c = cascade_desc[0];
+    int rn = c.rn;
+    int probes_w = c.probes_w, probes_h = c.probes_h;
+    const cascade_view_t& c0 = merged_cascade(0);
+    int k = light_step();
+    // another scale than last time, every pixel is redone
+    if (gathered_scale != k) rays = nullptr;
+    gathered_scale = k;
+    if (k > 1 && light_axes_scale != k) make_light_axes(k);
+
+    auto fluence = [&](int i, int j) {
+        float sum_rad[3] = {0.0, 0.0, 0.0};
+        for (int r = 0; r < r0; ++r) {
+            SDL_FColor c = c0.at(i * rn + r % rn, j * rn + r / rn);
+            sum_rad[0] += c.r;
+            sum_rad[1] += c.g;
+            sum_rad[2] += c.b;
+        }
+        buf_fluence[i * probes_h + j] = {sum_rad[0] / r0, sum_rad[1] / r0, sum_rad[2] / r0, 1.0};
+    };
+    auto light = [&](const tile_t& tile) {
+        for (int x = tile.x0; x < tile.x1; ++x)
+        for (int y = tile.y0; y < tile.y1; ++y)
+            buf_light.set(px(x, y), gather_pixel(x, y));
+    };
+
+    if (!rays) {
+        pool.parallel_for(tile_count(probes_w, probes_h, tile_size), [&](int t, int) {
+            tile_t tile = tile_rect(t, probes_w, probes_h, tile_size);
+            for (int i = tile.x0; i < tile.x1; ++i)
+                for (int j = tile.y0; j < tile.y1; ++j) fluence(i, j);
+        });
+        if (k > 1) {
+            upsample_light(screen_rect(), screen_rect());
+            return;
+        }
+        pool.parallel_for(tile_count(scr_w, scr_h, tile_size), [&](int t, int) {
+            light(tile_rect(t, scr_w, scr_h, tile_size));
+        });
+        return;
+    }
+
+    ray_set_t probes, cells;
+    probes.reset(static_cast<size_t>(probes_w) * probes_h);
+    cells.reset(static_cast<size_t>(probes_w) * probes_h);
+    for (int idx : rays->list) {
+        int i = idx / ray_h / rn, j = idx % ray_h / rn;
+        if (i >= probes_w || j >= probes_h) continue;
+        probes.add(i * probes_h + j);
+        for (int ci = std::max(i - 1, 0); ci <= i; ++ci)
+            for (int cj = std::max(j - 1, 0); cj <= j; ++cj) cells.add(ci * probes_h + cj);
+    }
+
+    pool.parallel_for(static_cast<int>(probes.list.size()), [&](int t, int) {
+        fluence(probes.list[t] / probes_h, probes.list[t] % probes_h);
+    });
+    if (k > 1) {
+        // the anchors in the redone cells, and everything reading them or
+        // lying where the edges moved
+        rect_t lit;
+        for (int idx : cells.list)
+            lit.add({cell_x[idx / probes_h], cell_y[idx % probes_h], cell_x[idx / probes_h + 1], cell_y[idx % probes_h + 1]});
+        rect_t up;
+        if (!lit.empty())    up.add(lit.expand(k));
+        if (!edited.empty()) up.add(edited.expand(k));
+        upsample_light(lit.clip(screen_rect()), up.clip(screen_rect()));
+        return;
+    }
+    pool.parallel_for(static_cast<int>(cells.list.size()), [&](int t, int) {
+        int i = cells.list[t] / probes_h, j = cells.list[t] % probes_h;
+        light({cell_x[i], cell_y[j], cell_x[i + 1], cell_y[j + 1]});
+    });
+}
+
+// Merges everything, or with `incremental` only the rays in dirty_rays plus
+// the rays reading them, cascade by cascade down to the lighting. `edited`
+// are the pixels whose objects changed.
+inline void merge_cascades(bool incremental = false, const rect_t& edited = {}) {
+    for (int Cn = max_cascade - 1; Cn >= 0; --Cn) {
+        profile_scope_t scope("merge", Cn);
+        if (incremental) add_readers(Cn, dirty_rays[Cn + 1], dirty_rays[Cn]);
+        merge_cascade(Cn, incremental ? &dirty_rays[Cn] : nullptr);
+    }
+    profile_scope_t scope("gather");
+    gather_cascade0(incremental ? &dirty_rays[0] : nullptr, edited);
+    for (ray_set_t& rays : dirty_rays) rays.clear();
+}
+
+inline void count_hits(const SDL_FColor* out, int n) {
+    long hits = 0;
+    for (int i = 0; i < n; ++i) hits += out[i].a == 0.0f;
+    march_hits += hits;
+}
+
+// runs trace(), which marches rays of cascade Cn, and adds what it marched to
+// stage_times.counters[Cn]; returns that part
+template <class F>
+inline profile_counters_t count_cascade(int Cn, F trace) {
+    long rays = stage_times.rays, steps = march_steps;
+    march_max_steps = 0;
+    march_hits = 0;
+    trace();
+    profile_counters_t d;
+    d.rays = stage_times.rays - rays;
+    d.steps = march_steps - steps;
+    d.max_steps = march_max_steps;
+    d.hits = march_hits;
+    profile_counters_t& c = stage_times.counters[Cn];
+    c.rays += d.rays;
+    c.steps += d.steps;
+    c.max_steps = std::max(c.max_steps, d.max_steps);
+    c.hits += d.hits;
+    return d;
+}
+
+// does o + d * t, t in [0, len], pass through the pixels of r
+inline bool segment_hits_rect(float ox, float oy, float dx, float dy, float len, const rect_t& r) {
+    float t0 = 0.0f, t1 = len;
+    auto slab = [&](float o, float d, float lo, float hi) {
+        if (d == 0.0f) return o >= lo && o <= hi;
+        float a = (lo - o) / d, b = (hi - o) / d;
+        if (a > b) std::swap(a, b);
+        t0 = std::max(t0, a);
+        t1 = std::min(t1, b);
+        return t0 <= t1;
+    };
+    return slab(ox, dx, r.x0, r.x1) && slab(oy, dy, r.y0, r.y1);
+}
+
+// Traces cascade Cn, or with `region` only the rays whose interval crosses it.
+// Those are also added to dirty_rays[Cn] for the next incremental merge. With
+// `defer` they are only added to it, to be traced by refresh_pending().
+template <int R0, int A, int S>
+inline void compute_cascade_t(int Cn, const rect_t* region, ray_set_t* defer) {
+    using cfg = cascade_cfg_t<R0, A, S>;
+    const cascade_desc_t& c = cascade_desc[Cn];
+    const cascade_view_t& rc = buf_rc[Cn];
+    march_field_t field = march_field(Cn);
+
+    tile_t area = {0, 0, ray_w, ray_h};
+    if (region) {
+        if (region->empty()) return;
+        // probes close enough for their longest rays to get there
+        float reach = c.r_start + c.r_len;
+        rect_t probes = rect_t{0, 0, c.cover_w, c.cover_h}.clip(
+                        {static_cast<int>(std::floor((region->x0 - reach) / c.dn - 0.5f)),
+                         static_cast<int>(std::floor((region->y0 - reach) / c.dn - 0.5f)),
+                         static_cast<int>(std::floor((region->x1 + reach) / c.dn - 0.5f)) + 1,
+                         static_cast<int>(std::floor((region->y1 + reach) / c.dn - 0.5f)) + 1});
+        if (probes.empty()) return;
+        area = {probes.x0 * c.rn, probes.y0 * c.rn, std::min(probes.x1 * c.rn, ray_w), std::min(probes.y1 * c.rn, ray_h)};
+    }
+    int n_tiles = tile_count(area, tile_size);
+    std::vector<std::vector<int>> traced(region ? n_tiles : 0);
+
+    // every tile becomes one SoA stream of rays for the packet marcher
+    pool.parallel_for(n_tiles, [&](int t, int) {
+        tile_t tile = tile_rect(t, area, tile_size);
+        int    n = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+
+        thread_local std::vector<float> ox, oy, dx, dy;
+        thread_local std::vector<SDL_FColor> out;
+        thread_local std::vector<int> at;
+        ox.resize(n); oy.resize(n); dx.resize(n); dy.resize(n); out.resize(n); at.resize(n);
+
+        int i = 0;
+        for (int x = tile.x0; x < tile.x1; ++x) {
+            float cx = c.centre[cfg::probe(x, c)];
+            int   rx = cfg::ray(x, c);
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            int r = rx + cfg::ray(y, c) * c.rn;
+            ox[i] = cx + c.start[r].x;
+            oy[i] = c.centre[cfg::probe(y, c)] + c.start[r].y;
+            dx[i] = c.dir[r].x;
+            dy[i] = c.dir[r].y;
+            if (region && !segment_hits_rect(ox[i], oy[i], dx[i], dy[i], c.r_len, *region)) continue;
+            at[i++] = x * ray_h + y;
+        }}
+        n = i;
+        if (defer) {
+            traced[t].assign(at.begin(), at.begin() + n);
+            return;
+        }
+
+        march_rays(march_simd, field, ox.data(), oy.data(), dx.data(), dy.data(), c.r_len, n, out.data());
+        if (profiling) count_hits(out.data(), n);
+
+        for (i = 0; i < n; ++i)
+            rc.set(at[i] / ray_h, at[i] % ray_h, out[i]);
+        if (region) traced[t].assign(at.begin(), at.begin() + n);
+    });
+
+    if (defer) {
+        for (const std::vector<int>& list : traced)
+            for (int idx : list) defer->add(idx);
+    }
+    else if (region) {
+        for (const std::vector<int>& list : traced) {
+            for (int idx : list) dirty_rays[Cn].add(idx);
+            stage_times.rays += list.size();
+        }
+    }
+    else
+        stage_times.rays += static_cast<long>(ray_w) * ray_h;
+}
+
+inline void compute_cascade(int Cn, const rect_t* region = nullptr, ray_set_t* defer = nullptr) {
+    if      (cascade_config_is(4, 4, 2))  compute_cascade_t<4, 4, 2>(Cn, region, defer);
+    else if (cascade_config_is(16, 4, 2)) compute_cascade_t<16, 4, 2>(Cn, region, defer);
+    else                                  compute_cascade_t<0, 0, 0>(Cn, region, defer);
+}
+
+// Traces the rays `list` (x * ray_h + y) of cascade Cn, keeping history_blend
+// of their old value, and adds them to dirty_rays[Cn]. Returns the rays that
+// moved by more than history_eps, those have not settled yet.
+template <int R0, int A, int S>
+inline std::vector<int> trace_rays_t(int Cn, const std::vector<int>& list) {
+    using cfg = cascade_cfg_t<R0, A, S>;
+    const cascade_desc_t& c = cascade_desc[Cn];
+    const cascade_view_t& rc = buf_rc[Cn];
+    march_field_t field = march_field(Cn);
+    int chunk = tile_size * tile_size;
+    int n_chunks = (static_cast<int>(list.size()) + chunk - 1) / chunk;
+    std::vector<std::vector<int>> unsettled(n_chunks);
+
+    pool.parallel_for(n_chunks, [&](int t, int) {
+        int begin = t * chunk, n = std::min(static_cast<int>(list.size()) - begin, chunk);
+
+        thread_local std::vector<float> ox, oy, dx, dy;
+        thread_local std::vector<SDL_FColor> out;
+        ox.resize(n); oy.resize(n); dx.resize(n); dy.resize(n); out.resize(n);
+
+        for (int i = 0; i < n; ++i) {
+            int x = list[begin + i] / ray_h, y = list[begin + i] % ray_h;
+            int r = cfg::ray(x, c) + cfg::ray(y, c) * c.rn;
+            ox[i] = c.centre[cfg::probe(x, c)] + c.start[r].x;
+            oy[i] = c.centre[cfg::probe(y, c)] + c.start[r].y;
+            dx[i] = c.dir[r].x;
+            dy[i] = c.dir[r].y;
+        }
+
+        march_rays(march_simd, field, ox.data(), oy.data(), dx.data(), dy.data(), c.r_len, n, out.data());
+        if (profiling) count_hits(out.data(), n);
+
+        for (int i = 0; i < n; ++i) {
+            int x = list[begin + i] / ray_h, y = list[begin + i] % ray_h;
+            SDL_FColor v = out[i];
+            if (history_blend > 0.0f) {
+                SDL_FColor old = rc.at(x, y);
+                float h = history_blend;
+                v = {old.r * h + v.r * (1 - h), old.g * h + v.g * (1 - h),
+                     old.b * h + v.b * (1 - h), old.a * h + v.a * (1 - h)};
+                float err = std::max({std::abs(v.r - out[i].r), std::abs(v.g - out[i].g),
+                                      std::abs(v.b - out[i].b), std::abs(v.a - out[i].a)});
+                if (err > history_eps) {
+                    // a compact format may round the blend back to the old
+                    // value for good, then the ray takes its trace instead
+                    rc.set(x, y, v);
+                    SDL_FColor now = rc.at(x, y);
+                    if (now.r != old.r || now.g != old.g || now.b != old.b || now.a != old.a) {
+                        unsettled[t].push_back(list[begin + i]);
+                        continue;
+                    }
+                }
+                // settled, it keeps the trace so it ends up as in a full frame
+                v = out[i];
+            }
+            rc.set(x, y, v);
+        }
+    });
+
+    std::vector<int> left;
+    for (int idx : list) dirty_rays[Cn].add(idx);
+    for (const std::vector<int>& u : unsettled) left.insert(left.end(), u.begin(), u.end());
+    stage_times.rays += list.size();
+    return left;
+}
+
+inline std::vector<int> trace_rays(int Cn, const std::vector<int>& list) {
+    if      (cascade_config_is(4, 4, 2))  return trace_rays_t<4, 4, 2>(Cn, list);
+    else if (cascade_config_is(16, 4, 2)) return trace_rays_t<16, 4, 2>(Cn, list);
+    else                                  return trace_rays_t<0, 0, 0>(Cn, list);
+}
+
+// One frame of the amortised cascades: traces the pending rays of the probes
+// whose turn it is, (i + j) % k == frame % k, within ray_budget. Returns the
+// rays traced; the time goes to stage_times.cascade.
+inline long refresh_pending() {
+    long traced = 0;
+    unsigned frame = amortise_frame++;
+    for (int Cn = 0; Cn <= max_cascade; ++Cn) {
+        ray_set_t& pending = pending_rays[Cn];
+        if (pending.list.empty()) continue;
+        profile_scope_t scope("amortised", Cn);
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        int k = period(Cn), rn = cascade_desc[Cn].rn;
+        long room = ray_budget > 0 ? ray_budget - traced : static_cast<long>(pending.list.size());
+        if (room <= 0) break;
+
+        std::vector<int> due;
+        pending.remove_if([&](int idx) {
+            int i = idx / ray_h / rn, j = idx % ray_h / rn;
+            if ((i + j) % k != static_cast<int>(frame % k) || static_cast<long>(due.size()) >= room) return false;
+            due.push_back(idx);
+            return true;
+        });
+        std::vector<int> left;
+        scope.count(count_cascade(Cn, [&] { left = trace_rays(Cn, due); }));
+        for (int idx : left) pending.add(idx);
+        traced += due.size();
+        stage_times.cascade[Cn] += ms_since(t0);
+    }
+    for (const ray_set_t& pending : pending_rays) stage_times.pending += pending.list.size();
+    return traced;
+}
+
+// TRACER_AUTO: traces every cascade with both tracers and keeps the faster
+inline void choose_tracers() {
+    long rays = stage_times.rays, steps = march_steps;
+    cascade_tracer.assign(max_cascade + 1, TRACER_SPHERE);
+    for (int Cn = 0; Cn <= max_cascade; ++Cn) {
+        double ms[2];
+        for (int k : {TRACER_SPHERE, TRACER_DDA}) {
+            cascade_tracer[Cn] = k;
+            Uint64 t0 = SDL_GetPerformanceCounter();
+            compute_cascade(Cn);
+            ms[k] = ms_since(t0);
+        }
+        cascade_tracer[Cn] = ms[TRACER_DDA] < ms[TRACER_SPHERE] ? TRACER_DDA : TRACER_SPHERE;
+        printf("cascade %d: sphere tracing %.3f ms, DDA %.3f ms, using %s\n", Cn, ms[TRACER_SPHERE], ms[TRACER_DDA],
+               cascade_tracer[Cn] == TRACER_DDA ? "DDA" : "sphere tracing");
+    }
+    stage_times.rays = rays;
+    march_steps = steps;
+}
+
+// traces every cascade with the scalar marcher and with march_simd and
+// reports the speed of both and the largest difference between them
+inline void compare_march_modes() {
+    int level = march_simd;
+    double t_scalar = 0, t_simd = 0, max_err = 0;
+    long mismatched = 0;
+
+    for (int Cn = 0; Cn <= max_cascade; ++Cn) {
+        std::vector<SDL_FColor> scalar(static_cast<size_t>(ray_w) * ray_h);
+        march_simd = SIMD_SCALAR;
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        compute_cascade(Cn);
+        t_scalar += ms_since(t0);
+        for (int x = 0; x < ray_w; ++x)
+            for (int y = 0; y < ray_h; ++y) scalar[static_cast<size_t>(x) * ray_h + y] = buf_rc[Cn].at(x, y);
+
+        march_simd = level;
+        t0 = SDL_GetPerformanceCounter();
+        compute_cascade(Cn);
+        t_simd += ms_since(t0);
+
+        for (int x = 0; x < ray_w; ++x)
+            for (int y = 0; y < ray_h; ++y) {
+                SDL_FColor a = scalar[static_cast<size_t>(x) * ray_h + y];
+                SDL_FColor b = buf_rc[Cn].at(x, y);
+                double err = std::max({std::abs(a.r - b.r), std::abs(a.g - b.g), std::abs(a.b - b.b), std::abs(a.a - b.a)});
+                if (err > 0) ++mismatched;
+                if (err > max_err) max_err = err;
+            }
+    }
+    printf("march scalar: %.3f ms | %s: %.3f ms | %ld rays differ, max err %g\n",
+           t_scalar, simd_name(level), t_simd, mismatched, max_err);
+}
+
+// One frame. Only what the objects changed since the last call can reach is
+// redone: their old and new pixels in buf_obj, the EDT columns through them,
+// the rays crossing them and the merged rays and pixels downstream of those.
+// Cascades with a period > 1 catch up over the next frames instead.
+// Merging is only needed when the lighting is shown/written.
+inline void compute(bool merge) {
+    bool   full  = scene_dirty;
+    rect_t dirty = scene_changes();
+    scene_dirty  = false;
+    // past half the screen one full pass is cheaper than culling rays
+    if (dirty.area() * 2 > screen_rect().area()) {
+        full  = true;
+        dirty = screen_rect();
+    }
+
+    stage_times = stage_times_t();
+    stage_times.cascade.assign(max_cascade + 1, 0.0);
+    stage_times.counters.assign(max_cascade + 1, profile_counters_t());
+    stage_times.dirty = dirty;
+    long steps0 = march_steps;
+
+    if (!dirty.empty()) {
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        {
+            profile_scope_t scope("objects");
+            fill_buf_obj(dirty);
+            occupancy.build(buf_obj.data(), dirty);
+        }
+        stage_times.obj = ms_since(t0);
+
+        // only DDA tracing: no distance field until something reads it again
+        t0 = SDL_GetPerformanceCounter();
+        if (needs_dist()) {
+            profile_scope_t scope("distance");
+            fill_buf_dist(dist_stale ? screen_rect() : dirty);
+            dist_stale = false;
+        }
+        else
+            dist_stale = true;
+        stage_times.dist = ms_since(t0);
+        if (solver == SOLVER_RC && tracer_mode == TRACER_AUTO && cascade_tracer.empty()) choose_tracers();
+
+        // the distance field changes around the edit too, a ray that only
+        // passes near it may step differently but reaches the same surface
+        rect_t reach = dirty.expand(1);
+        for (int i = max_cascade; i >= 0 && solver == SOLVER_RC; --i) {
+            profile_scope_t scope("cascade", i);
+            t0 = SDL_GetPerformanceCounter();
+            if (full) pending_rays[i].clear();
+            scope.count(count_cascade(i, [&] {
+                compute_cascade(i, full ? nullptr : &reach, !full && period(i) > 1 ? &pending_rays[i] : nullptr);
+            }));
+            stage_times.cascade[i] = ms_since(t0);
+        }
+    }
+    // rays the amortised cascades trace this frame need merging like an edit
+    bool changed = !dirty.empty();
+    if (solver == SOLVER_RC && refresh_pending() > 0) changed = true;
+    stage_times.steps = march_steps - steps0;
+
+    // HRC has nothing to reuse between frames, it redoes everything at once
+    if (solver == SOLVER_HRC) {
+        if (merge && (merged_stale || !dirty.empty())) {
+            profile_scope_t scope("hrc");
+            hrc.solve(pool, tile_size, march_field(), march_simd, buf_light);
+            stage_times.cascade = hrc.level_ms;
+            stage_times.merge   = hrc.merge_ms;
+            stage_times.rays    = hrc.traced;
+            stage_times.steps   = march_steps - steps0;
+            merged_stale = false;
+        }
+        else if (!dirty.empty())
+            merged_stale = true;
+        return;
+    }
+
+    if (merge && (merged_stale || changed)) {
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        merge_cascades(!merged_stale && !full, dirty);
+        stage_times.merge = ms_since(t0);
+        merged_stale = false;
+    }
+    else if (changed) {
+        merged_stale = true;
+        for (ray_set_t& rays : dirty_rays) rays.clear();
+    }
+    // only light_scale changed, the merged cascades still hold
+    else if (merge && gathered_scale != light_step()) {
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        profile_scope_t scope("gather");
+        gather_cascade0();
+        stage_times.merge = ms_since(t0);
+    }
+}
+
+// redoes the last frame from scratch and reports how far the incremental
+// buf_light was from it
+inline void compare_incremental() {
+    color_buffer_t inc = buf_light;
+    invalidate_scene();
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    compute(true);
+    double t_full = ms_since(t0);
+
+    double max_err = 0;
+    long   differ = 0;
+    for (size_t i = 0; i < inc.size(); ++i) {
+        SDL_FColor a = inc.at(i);
+        SDL_FColor b = buf_light.at(i);
+        double err = std::max({std::abs(a.r - b.r), std::abs(a.g - b.g), std::abs(a.b - b.b)});
+        if (err > 0) ++differ;
+        if (err > max_err) max_err = err;
+    }
+    printf("full frame: %.3f ms | %ld of %zu pixels differ from incremental, max err %g\n",
+           t_full, differ, inc.size(), max_err);
+}
+
+inline void free_solver() {
+    cascade_tracer.clear();
+    dist_stale = false;
+    dirty_rays.clear();
+    pending_rays.clear();
+    scene_state.clear();
+    scene_dirty  = true;
+    merged_stale = true;
+    cascade_desc.clear();
+    buf_rc.clear();
+    buf_merged.clear();
+    cascade_arena.release();
+    hrc.release();
+    gathered_scale = light_axes_scale = 0;
+}
+
+// switches between RC and HRC, everything is redone on the next compute()
+inline void set_solver(int s) {
+    solver = s;
+    invalidate_scene();
+    merged_stale = true;
+}
+
+// same for the tracer, TRACER_AUTO measures both again
+inline void set_tracer(int t) {
+    tracer_mode = t;
+    cascade_tracer.clear();
+    invalidate_scene();
+    merged_stale = true;
+}
+
+// packed cells on or off, the palette and buf_cell are filled on the next compute()
+inline void set_cells(bool on) {
+    // while off draws skipped buf_cell, so nothing of it can be trusted
+    if (on && !march_cells) std::fill(buf_cell.begin(), buf_cell.end(), 0);
+    march_cells = on;
+    invalidate_scene();
+    merged_stale = true;
+}
+
+// Sizes every buffer for scr_w x scr_h and the current cascade config.
+// cascades = 0 derives the cascade count from the screen diagonal.
+// Returns false when the cascade arena cannot be allocated.
+// the per-pixel buffers for scr_w x scr_h, false if they do not fit in memory
+inline bool alloc_pixel_buffers() {
+    try {
+        buf_obj.assign(pixel_count(scr_w, scr_h), material_t({0,0,0,0},0));
+        buf_dist.assign(pixel_count(scr_w, scr_h), 0.0f);
+        buf_cell.assign(pixel_count(scr_w, scr_h), 0);
+        buf_edt_cols.assign(static_cast<size_t>(scr_w) * scr_h, 0.0f);
+        occupancy.resize(scr_w, scr_h);
+        drawn.resize(scr_w, scr_h);
+        // blocks up to 64 pixels, coarser ones are seldom clear
+        dist_mip.resize(scr_w, scr_h, std::min(6, static_cast<int>(std::log2(std::max(scr_w, scr_h)))));
+        buf_light.assign(pixel_count(scr_w, scr_h), light_format, {0.0, 0.0, 0.0, 1.0});
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+inline bool init_solver(int cascades = 0) {
+    free_solver();
+    // cascade 0 needs at least one whole probe, the gather cells assume it
+    if (d0 > std::min(scr_w, scr_h)) {
+        fprintf(stderr, "Probe spacing %d does not fit a %dx%d screen\n", d0, scr_w, scr_h);
+        return false;
+    }
+
+    if (std::max(scr_w, scr_h) > PIXEL_MAX_SIZE) {
+        fprintf(stderr, "Screen %dx%d is larger than %d a side\n", scr_w, scr_h, PIXEL_MAX_SIZE);
+        return false;
+    }
+
+    diagonal = std::sqrt(static_cast<float>(scr_w) * scr_w + static_cast<float>(scr_h) * scr_h);
+    ray_w = sqrt(r0) * scr_w / d0;
+    ray_h = sqrt(r0) * scr_h / d0;
+
+    if (!alloc_pixel_buffers()) {
+        fprintf(stderr, "Could not allocate the pixel buffers for %dx%d\n", scr_w, scr_h);
+        free_solver();
+        return false;
+    }
+
+    if (cascades > 0)
+        max_cascade = cascades - 1;
+    else {
+        int factor = ceil(log(diagonal / d0) / log(static_cast<float>(ray_len_factor)));
+
+        int intervalstart = (d0 * (1.0 - pow((s_res_factor * s_res_factor), factor))) / (1.0 - (s_res_factor * s_res_factor));
+        max_cascade = ceil(log(intervalstart) / log(s_res_factor * s_res_factor)) - 1;
+    }
+    // every cascade needs at least one whole probe
+    while (max_cascade > 0 && d0 * pow(s_res_factor, max_cascade) > std::min(scr_w, scr_h))
+        --max_cascade;
+    // every cascade's rays have to form a square of rn x rn
+    for (int Cn = 0; Cn <= max_cascade; ++Cn) {
+        long long rays = r0;
+        for (int k = 0; k < Cn; ++k) rays *= a_res_factor;
+        long long rn = std::llround(std::sqrt(static_cast<double>(rays)));
+        if (rn * rn != rays) {
+            fprintf(stderr, "Cascade %d would have %lld rays per probe, not a square (r0 %d, angular factor %d)\n",
+                    Cn, rays, r0, a_res_factor);
+            return false;
+        }
+    }
+    printf("Will render %d cascades\n", (max_cascade + 1));
+
+    if (!cascade_arena.alloc(2 * max_cascade + 1, ray_w, ray_h, cascade_format)) {
+        fprintf(stderr, "Could not allocate %d cascade buffers of %dx%d\n", 2 * max_cascade + 1, ray_w, ray_h);
+        return false;
+    }
+    for (int Cn = 0; Cn <= max_cascade; ++Cn) buf_rc.push_back(cascade_arena.level(Cn));
+    for (int Cn = 0; Cn <  max_cascade; ++Cn) buf_merged.push_back(cascade_arena.level(max_cascade + 1 + Cn));
+    for (int Cn = 0; Cn <= max_cascade; ++Cn)
+        cascade_desc.push_back(make_cascade_desc(Cn));
+    buf_fluence.assign((scr_w / d0) * (scr_h / d0), {0.0, 0.0, 0.0, 1.0});
+    dirty_rays.assign(max_cascade + 1, ray_set_t());
+    for (ray_set_t& rays : dirty_rays) rays.reset(static_cast<size_t>(ray_w) * ray_h);
+    pending_rays.assign(max_cascade + 1, ray_set_t());
+    for (ray_set_t& rays : pending_rays) rays.reset(static_cast<size_t>(ray_w) * ray_h);
+
+    // gather cells: cell k holds the pixels whose footprint starts at probe k
+    auto cells = [](int n_px, int n_probes, std::vector<int>& first) {
+        first.assign(n_probes + 1, n_px);
+        for (int x = n_px - 1; x >= 0; --x)
+            first[probe_axis(x, d0, n_probes).i0] = x;
+        for (int k = n_probes - 1; k >= 0; --k)
+            first[k] = std::min(first[k], first[k + 1]);
+    };
+    cells(scr_w, cascade_desc[0].probes_w, cell_x);
+    cells(scr_h, cascade_desc[0].probes_h, cell_y);
+    gathered_scale = light_axes_scale = 0;
+    hrc.init(scr_w, scr_h, hrc_d0);
+
+    printf("Allocated %d buffers of %dx%d %s %s (%zuKB total), %s lighting (%zuKB)\n", cascade_arena.count(),
+    static_cast<int>(ray_w), static_cast<int>(ray_h), layout_name(), color_format_name(cascade_format),
+    cascade_arena.bytes() / 1024, color_format_name(light_format), buf_light.bytes() / 1024);
+
+    pool.resize(n_threads);
+    pool.deterministic = deterministic;
+    march_simd = std::min(march_simd, simd_detect());
+    printf("Using %d threads%s, %s ray marcher, %s pixels\n", pool.size(), deterministic ? " (deterministic)" : "",
+           simd_name(march_simd), pixel_layout_name());
+    return true;
+}
+
+#endif
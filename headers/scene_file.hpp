@@ -0,0 +1,484 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "geometry.hpp"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SCENE_MMAP
+#endif
+
+// Scene files, in pixel coordinates.
+//
+// .rcs is the binary form, little endian, every field 4 bytes so each array
+// is aligned in a mapping:
+//   scene_header_t
+//   materials  header.materials x scene_material_t
+//   circles    header.circles   x scene_circle_t
+//   rects      header.rects     x scene_rect_t
+//   triangles  header.triangles x scene_triangle_t
+//   lines      header.lines     x scene_line_t
+//   order      header.order     x uint32, kind << 30 | index in its array
+// `order` is the scene order of the objects (draw order, picking), either
+// every object once or empty for the arrays back to back. The file is
+// mapped and read in place, the only work per object is constructing it.
+//
+// Everything else is the text form, one item per line, '#' starts a comment:
+//   size W H
+//   material NAME R G B A EMISSIVITY
+//   circle MATERIAL CX CY RADIUS
+//   rect MATERIAL CX CY HALF_W HALF_H
+//   triangle MATERIAL X0 Y0 X1 Y1 X2 Y2
+//   line MATERIAL X0 Y0 X1 Y1 THICKNESS
+// Materials have to be declared before their first use.
+
+const uint32_t SCENE_VERSION = 1;
+
+// a size the solver can allocate for, see PIXEL_MAX_SIZE
+inline bool scene_size_ok(uint32_t w, uint32_t h) {
+    return w <= static_cast<uint32_t>(PIXEL_MAX_SIZE) && h <= static_cast<uint32_t>(PIXEL_MAX_SIZE);
+}
+
+enum scene_kinds { SCENE_CIRCLE, SCENE_RECT, SCENE_TRIANGLE, SCENE_LINE };
+
+// entry of the order table
+inline uint32_t scene_ref(uint32_t kind, uint32_t k) { return kind << 30 | k; }
+
+struct scene_header_t {
+    char     magic[4];          // "RCSC"
+    uint32_t version;
+    uint32_t width, height;     // size the scene was laid out for
+    uint32_t materials, circles, rects, triangles, lines, order;
+};
+struct scene_material_t { float r, g, b, a, emissivity; };
+struct scene_circle_t   { uint32_t material; float cx, cy, radius; };
+struct scene_rect_t     { uint32_t material; float cx, cy, hw, hh; };
+struct scene_triangle_t { uint32_t material; float x0, y0, x1, y1, x2, y2; };
+struct scene_line_t     { uint32_t material; float x0, y0, x1, y1, thickness; };
+
+// read-only view of a whole file, mapped where possible
+class mapped_file_t {
+public:
+    mapped_file_t() {}
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+    ~mapped_file_t() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef SCENE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = p != MAP_FAILED;
+            if (ok) {
+                bytes = static_cast<const uint8_t*>(p);
+                length = st.st_size;
+                madvise(p, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        return ok;
+#else
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) return false;
+        uint8_t chunk[65536];
+        size_t  n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) copy.insert(copy.end(), chunk, chunk + n);
+        bool ok = !ferror(f);
+        fclose(f);
+        bytes = copy.data();
+        length = copy.size();
+        return ok;
+#endif
+    }
+
+    void close() {
+#ifdef SCENE_MMAP
+        if (bytes) munmap(const_cast<uint8_t*>(bytes), length);
+#else
+        copy.clear();
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* data() const { return bytes; }
+    size_t         size() const { return length; }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t         length = 0;
+#ifndef SCENE_MMAP
+    std::vector<uint8_t> copy;
+#endif
+};
+
+// the arrays of an .rcs image, pointing into it
+struct scene_view_t {
+    const scene_header_t*   header = nullptr;
+    const scene_material_t* materials = nullptr;
+    const scene_circle_t*   circles = nullptr;
+    const scene_rect_t*     rects = nullptr;
+    const scene_triangle_t* triangles = nullptr;
+    const scene_line_t*     lines = nullptr;
+    const uint32_t*         order = nullptr;
+};
+
+inline bool is_binary_scene(const uint8_t* data, size_t size) {
+    return size >= 4 && !memcmp(data, "RCSC", 4);
+}
+
+// checks sizes and indices so nothing can read outside the image, prints why not
+inline bool scene_view(const uint8_t* data, size_t size, scene_view_t& v) {
+    if (size < sizeof(scene_header_t) || !is_binary_scene(data, size)) {
+        fprintf(stderr, "Not a binary scene\n");
+        return false;
+    }
+    const scene_header_t* h = reinterpret_cast<const scene_header_t*>(data);
+    if (h->version != SCENE_VERSION) {
+        fprintf(stderr, "Scene version %u, expected %u\n", h->version, SCENE_VERSION);
+        return false;
+    }
+    uint64_t objects = uint64_t(h->circles) + h->rects + h->triangles + h->lines;
+    uint64_t need = sizeof(scene_header_t) + uint64_t(h->materials) * sizeof(scene_material_t) +
+                    uint64_t(h->circles) * sizeof(scene_circle_t) + uint64_t(h->rects) * sizeof(scene_rect_t) +
+                    uint64_t(h->triangles) * sizeof(scene_triangle_t) + uint64_t(h->lines) * sizeof(scene_line_t) +
+                    uint64_t(h->order) * sizeof(uint32_t);
+    if (need != size || (h->order != 0 && h->order != objects)) {
+        fprintf(stderr, "Scene is %zu bytes, its header describes %llu\n", size, static_cast<unsigned long long>(need));
+        return false;
+    }
+    if (!scene_size_ok(h->width, h->height)) {
+        fprintf(stderr, "Scene size %ux%u, at most %d a side\n", h->width, h->height, PIXEL_MAX_SIZE);
+        return false;
+    }
+
+    const uint8_t* p = data + sizeof(scene_header_t);
+    auto take = [&p](auto*& out, uint32_t n) {
+        out = reinterpret_cast<std::remove_reference_t<decltype(out)>>(p);
+        p += n * sizeof(*out);
+    };
+    v.header = h;
+    take(v.materials, h->materials);
+    take(v.circles, h->circles);
+    take(v.rects, h->rects);
+    take(v.triangles, h->triangles);
+    take(v.lines, h->lines);
+    take(v.order, h->order);
+
+    bool ok = true;
+    auto check = [&](const auto* a, uint32_t n) {
+        for (uint32_t i = 0; i < n; ++i) ok &= a[i].material < h->materials;
+    };
+    check(v.circles, h->circles);
+    check(v.rects, h->rects);
+    check(v.triangles, h->triangles);
+    check(v.lines, h->lines);
+    const uint32_t counts[4] = {h->circles, h->rects, h->triangles, h->lines};
+    for (uint32_t i = 0; i < h->order; ++i) ok &= (v.order[i] & 0x3fffffffu) < counts[v.order[i] >> 30];
+    if (!ok) fprintf(stderr, "Scene refers to materials or objects it does not have\n");
+    return ok;
+}
+
+// appends object k of `kind` in the view to objects
+inline void add_scene_object(const scene_view_t& v, uint32_t kind, uint32_t k,
+                             std::vector<std::unique_ptr<Object>>& objects) {
+    auto mat = [&v](uint32_t m) {
+        const scene_material_t& s = v.materials[m];
+        return material_t({s.r, s.g, s.b, s.a}, s.emissivity);
+    };
+    switch (kind) {
+        case SCENE_CIRCLE: {
+            const scene_circle_t& c = v.circles[k];
+            objects.push_back(std::make_unique<Circle>(vec2(c.cx, c.cy), c.radius, mat(c.material)));
+            break;
+        }
+        case SCENE_RECT: {
+            const scene_rect_t& r = v.rects[k];
+            objects.push_back(std::make_unique<Rectangle>(vec2(r.cx, r.cy), vec2(r.hw, r.hh), mat(r.material)));
+            break;
+        }
+        case SCENE_TRIANGLE: {
+            const scene_triangle_t& t = v.triangles[k];
+            objects.push_back(std::make_unique<Triangle>(vec2(t.x0, t.y0), vec2(t.x1, t.y1), vec2(t.x2, t.y2), mat(t.material)));
+            break;
+        }
+        default: {
+            const scene_line_t& l = v.lines[k];
+            objects.push_back(std::make_unique<Line>(vec2(l.x0, l.y0), vec2(l.x1, l.y1), l.thickness, mat(l.material)));
+            break;
+        }
+    }
+}
+
+inline void load_scene_view(const scene_view_t& v, std::vector<std::unique_ptr<Object>>& objects) {
+    const scene_header_t& h = *v.header;
+    objects.reserve(objects.size() + h.circles + h.rects + h.triangles + h.lines);
+    if (h.order > 0) {
+        for (uint32_t i = 0; i < h.order; ++i) add_scene_object(v, v.order[i] >> 30, v.order[i] & 0x3fffffffu, objects);
+        return;
+    }
+    const uint32_t counts[4] = {h.circles, h.rects, h.triangles, h.lines};
+    for (uint32_t kind = 0; kind < 4; ++kind)
+        for (uint32_t k = 0; k < counts[kind]; ++k) add_scene_object(v, kind, k, objects);
+}
+
+// parses the text form into the same arrays the binary form holds
+struct scene_text_t {
+    scene_header_t                 header = {{'R', 'C', 'S', 'C'}, SCENE_VERSION, 0, 0, 0, 0, 0, 0, 0, 0};
+    std::vector<scene_material_t>  materials;
+    std::vector<scene_circle_t>    circles;
+    std::vector<scene_rect_t>      rects;
+    std::vector<scene_triangle_t>  triangles;
+    std::vector<scene_line_t>      lines;
+    std::vector<uint32_t>          order;
+
+    scene_view_t view() {
+        header.materials = materials.size();
+        header.circles = circles.size();
+        header.rects = rects.size();
+        header.triangles = triangles.size();
+        header.lines = lines.size();
+        header.order = order.size();
+        return {&header, materials.data(), circles.data(), rects.data(), triangles.data(), lines.data(), order.data()};
+    }
+};
+
+inline bool parse_scene_text(const char* text, size_t size, scene_text_t& s) {
+    std::map<std::string, uint32_t> names;
+    std::string line;
+    int  n_line = 0;
+    bool ok = true;
+    for (size_t pos = 0; pos < size && ok;) {
+        size_t end = pos;
+        while (end < size && text[end] != '\n') ++end;
+        line.assign(text + pos, end - pos);
+        pos = end + 1;
+        ++n_line;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+
+        char  word[64], name[64];
+        float f[7];
+        int   w, h, used = 0;
+        if (sscanf(line.c_str(), " %63s%n", word, &used) != 1) continue;
+        const char* rest = line.c_str() + used;
+        auto material = [&](uint32_t& m) {
+            auto it = names.find(name);
+            if (it == names.end()) {
+                fprintf(stderr, "Scene line %d: unknown material \"%s\"\n", n_line, name);
+                return false;
+            }
+            m = it->second;
+            return true;
+        };
+        auto placed = [&](uint32_t kind, size_t count) { s.order.push_back(scene_ref(kind, static_cast<uint32_t>(count - 1))); };
+
+        if (!strcmp(word, "size") && sscanf(rest, "%d %d", &w, &h) == 2 && w > 0 && h > 0) {
+            if (!scene_size_ok(w, h)) {
+                fprintf(stderr, "Scene line %d: size %dx%d, at most %d a side\n", n_line, w, h, PIXEL_MAX_SIZE);
+                ok = false;
+            }
+            s.header.width = w;
+            s.header.height = h;
+        }
+        else if (!strcmp(word, "material") && sscanf(rest, "%63s %f %f %f %f %f", name, &f[0], &f[1], &f[2], &f[3], &f[4]) == 6) {
+            names[name] = static_cast<uint32_t>(s.materials.size());
+            s.materials.push_back({f[0], f[1], f[2], f[3], f[4]});
+        }
+        else if (!strcmp(word, "circle") && sscanf(rest, "%63s %f %f %f", name, &f[0], &f[1], &f[2]) == 4) {
+            scene_circle_t c = {0, f[0], f[1], f[2]};
+            if ((ok = material(c.material))) { s.circles.push_back(c); placed(SCENE_CIRCLE, s.circles.size()); }
+        }
+        else if (!strcmp(word, "rect") && sscanf(rest, "%63s %f %f %f %f", name, &f[0], &f[1], &f[2], &f[3]) == 5) {
+            scene_rect_t r = {0, f[0], f[1], f[2], f[3]};
+            if ((ok = material(r.material))) { s.rects.push_back(r); placed(SCENE_RECT, s.rects.size()); }
+        }
+        else if (!strcmp(word, "triangle") &&
+                 sscanf(rest, "%63s %f %f %f %f %f %f", name, &f[0], &f[1], &f[2], &f[3], &f[4], &f[5]) == 7) {
+            scene_triangle_t t = {0, f[0], f[1], f[2], f[3], f[4], f[5]};
+            if ((ok = material(t.material))) { s.triangles.push_back(t); placed(SCENE_TRIANGLE, s.triangles.size()); }
+        }
+        else if (!strcmp(word, "line") && sscanf(rest, "%63s %f %f %f %f %f", name, &f[0], &f[1], &f[2], &f[3], &f[4]) == 6) {
+            scene_line_t l = {0, f[0], f[1], f[2], f[3], f[4]};
+            if ((ok = material(l.material))) { s.lines.push_back(l); placed(SCENE_LINE, s.lines.size()); }
+        }
+        else {
+            fprintf(stderr, "Scene line %d: cannot read \"%s\"\n", n_line, line.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// appends the objects of a scene file, either form. w, h get the size it
+// was laid out for, 0 when it does not say.
+inline bool load_scene_file(const std::string& path, std::vector<std::unique_ptr<Object>>& objects, int* w = nullptr, int* h = nullptr) {
+    mapped_file_t file;
+    if (!file.open(path)) {
+        fprintf(stderr, "Could not read scene \"%s\"\n", path.c_str());
+        return false;
+    }
+    scene_view_t v;
+    scene_text_t text;
+    if (is_binary_scene(file.data(), file.size())) {
+        if (!scene_view(file.data(), file.size(), v)) return false;
+    }
+    else {
+        if (!parse_scene_text(reinterpret_cast<const char*>(file.data()), file.size(), text)) return false;
+        v = text.view();
+    }
+    if (w) *w = v.header->width;
+    if (h) *h = v.header->height;
+    load_scene_view(v, objects);
+    return true;
+}
+
+// size a scene file was laid out for without loading it, false when it does
+// not say
+inline bool scene_file_size(const std::string& path, int& w, int& h) {
+    mapped_file_t file;
+    if (!file.open(path)) return false;
+    const char* text = reinterpret_cast<const char*>(file.data());
+    w = h = 0;
+    if (is_binary_scene(file.data(), file.size())) {
+        if (file.size() < sizeof(scene_header_t)) return false;
+        const scene_header_t* header = reinterpret_cast<const scene_header_t*>(file.data());
+        w = header->width;
+        h = header->height;
+    }
+    else
+        for (size_t pos = 0; pos < file.size(); ++pos)
+            if ((pos == 0 || text[pos - 1] == '\n') && file.size() - pos > 5 && !strncmp(text + pos, "size ", 5)) {
+                std::string line(text + pos, std::min<size_t>(file.size() - pos, 64));
+                sscanf(line.c_str(), "size %d %d", &w, &h);
+                break;
+            }
+    return w > 0 && h > 0 && scene_size_ok(w, h);
+}
+
+// Collects objects back into the file arrays. Identical materials share an
+// entry, triangles and lines are stored by their points like they draw.
+inline void scene_from_objects(const std::vector<std::unique_ptr<Object>>& objects, int w, int h, scene_text_t& s) {
+    s = scene_text_t();
+    s.header.width = w;
+    s.header.height = h;
+    std::map<std::tuple<float, float, float, float, float>, uint32_t> known;
+    for (const auto& o : objects) {
+        const material_t& m = o->material;
+        auto key = std::make_tuple(m.color.r, m.color.g, m.color.b, m.color.a, m.emissivity);
+        auto it = known.find(key);
+        if (it == known.end()) {
+            it = known.emplace(key, static_cast<uint32_t>(s.materials.size())).first;
+            s.materials.push_back({m.color.r, m.color.g, m.color.b, m.color.a, m.emissivity});
+        }
+        uint32_t mat = it->second;
+        switch (o->shape) {
+            case CIRCLE: {
+                const Circle& c = static_cast<const Circle&>(*o);
+                s.circles.push_back({mat, c.centre.x, c.centre.y, c.radius});
+                s.order.push_back(scene_ref(SCENE_CIRCLE, static_cast<uint32_t>(s.circles.size() - 1)));
+                break;
+            }
+            case RECTANGLE: {
+                const Rectangle& r = static_cast<const Rectangle&>(*o);
+                s.rects.push_back({mat, r.centre.x, r.centre.y, r.size.x, r.size.y});
+                s.order.push_back(scene_ref(SCENE_RECT, static_cast<uint32_t>(s.rects.size() - 1)));
+                break;
+            }
+            case TRIANGLE: {
+                const Triangle& t = static_cast<const Triangle&>(*o);
+                s.triangles.push_back({mat, t.p0.x, t.p0.y, t.p1.x, t.p1.y, t.p2.x, t.p2.y});
+                s.order.push_back(scene_ref(SCENE_TRIANGLE, static_cast<uint32_t>(s.triangles.size() - 1)));
+                break;
+            }
+            default: {
+                const Line& l = static_cast<const Line&>(*o);
+                s.lines.push_back({mat, l.start.x, l.start.y, l.end.x, l.end.y, l.thickness});
+                s.order.push_back(scene_ref(SCENE_LINE, static_cast<uint32_t>(s.lines.size() - 1)));
+                break;
+            }
+        }
+    }
+    s.view();
+}
+
+inline bool write_scene_binary(const std::string& path, scene_text_t& s) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    s.view();
+    // empty arrays have no data() to hand to fwrite
+    auto put = [f](const auto& a) {
+        if (!a.empty()) fwrite(a.data(), sizeof(a[0]), a.size(), f);
+    };
+    fwrite(&s.header, sizeof(s.header), 1, f);
+    put(s.materials);
+    put(s.circles);
+    put(s.rects);
+    put(s.triangles);
+    put(s.lines);
+    put(s.order);
+    return fclose(f) == 0;
+}
+
+// %.9g round-trips every float, materials are named m<index>
+inline bool write_scene_text(const std::string& path, scene_text_t& s) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    scene_view_t v = s.view();
+    if (s.header.width > 0) fprintf(f, "size %u %u\n", s.header.width, s.header.height);
+    for (size_t i = 0; i < s.materials.size(); ++i) {
+        const scene_material_t& m = s.materials[i];
+        fprintf(f, "material m%zu %.9g %.9g %.9g %.9g %.9g\n", i, m.r, m.g, m.b, m.a, m.emissivity);
+    }
+    auto put = [&](uint32_t kind, uint32_t k) {
+        switch (kind) {
+            case SCENE_CIRCLE: {
+                const scene_circle_t& c = v.circles[k];
+                fprintf(f, "circle m%u %.9g %.9g %.9g\n", c.material, c.cx, c.cy, c.radius);
+                break;
+            }
+            case SCENE_RECT: {
+                const scene_rect_t& r = v.rects[k];
+                fprintf(f, "rect m%u %.9g %.9g %.9g %.9g\n", r.material, r.cx, r.cy, r.hw, r.hh);
+                break;
+            }
+            case SCENE_TRIANGLE: {
+                const scene_triangle_t& t = v.triangles[k];
+                fprintf(f, "triangle m%u %.9g %.9g %.9g %.9g %.9g %.9g\n", t.material, t.x0, t.y0, t.x1, t.y1, t.x2, t.y2);
+                break;
+            }
+            default: {
+                const scene_line_t& l = v.lines[k];
+                fprintf(f, "line m%u %.9g %.9g %.9g %.9g %.9g\n", l.material, l.x0, l.y0, l.x1, l.y1, l.thickness);
+                break;
+            }
+        }
+    };
+    if (!s.order.empty())
+        for (uint32_t o : s.order) put(o >> 30, o & 0x3fffffffu);
+    else {
+        const uint32_t counts[4] = {v.header->circles, v.header->rects, v.header->triangles, v.header->lines};
+        for (uint32_t kind = 0; kind < 4; ++kind)
+            for (uint32_t k = 0; k < counts[kind]; ++k) put(kind, k);
+    }
+    return fclose(f) == 0;
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "radiance.hpp"
+#include "scene_file.hpp"
+
+// Built-in scenes, laid out relative to scr_w x scr_h. Anything else is
+// loaded from scene files, see scene_file.hpp.
+
+// the generator the built-in scenes are laid out with, floats in [0, 1)
+struct scene_rng_t {
+    unsigned int seed;
+    float operator()() {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / static_cast<float>(1 << 24);
+    }
+};
+
+inline void load_obj() {
+    int r = 50;
+    objects.push_back(std::make_unique<Rectangle>(vec2(scr_w * 0.375, scr_h * 0.375), vec2(r, r/2), material_t({0x40/255.0f, 0x40/255.0f, 0x40/255.0f, 1.0}, 0.0f)));
+
+    objects.push_back(std::make_unique<Circle>(vec2(scr_w * 0.50, scr_h * 0.50), 25, material_t({0xff/255.0f, 0xf0/255.0f, 0xe3/255.0f, 1.0f}, 1.0f)));
+    objects.push_back(std::make_unique<Circle>(vec2(scr_w * 0.25, scr_h * 0.25), r/4, material_t({0xff/255.0f, 0x10/255.0f, 0x00/255.0f, 1.0f}, 1.0f)));
+    objects.push_back(std::make_unique<Circle>(vec2(scr_w * 0.75, scr_h * 0.25), r/4, material_t({0x00/255.0f, 0xff/255.0f, 0x00/255.0f, 1.0f}, 1.0f)));
+    objects.push_back(std::make_unique<Circle>(vec2(scr_w * 0.25, scr_h * 0.75), r/2, material_t({0x00/255.0f, 0x20/255.0f, 0xff/255.0f, 1.0f}, 1.0f)));
+    //objects.push_back(std::make_unique<Circle>(vec2(scr_w * 0.75, scr_h * 0.75), 25, material_t({0xfc/255.0f, 0x51/255.0f, 0x69/255.0f, 1.0f}, 1.0f)));
+}
+
+// n small circles and boxes spread over the screen, a quarter of them
+// emissive, to stress the object queries. Always the same layout.
+inline void load_scatter(int n) {
+    scene_rng_t rnd = {12345};
+    for (int i = 0; i < n; ++i) {
+        float x = rnd() * scr_w;
+        vec2  c = vec2(x, rnd() * scr_h);
+        float size = 1.0f + rnd() * 3.0f;
+        material_t m = rnd() < 0.25f ? material_t({rnd(), rnd(), rnd(), 1.0f}, 1.0f)
+                                     : material_t({0.25f, 0.25f, 0.25f, 1.0f}, 0.0f);
+        if (i % 2) objects.push_back(std::make_unique<Circle>(c, size, m));
+        else       objects.push_back(std::make_unique<Rectangle>(c, vec2(size, size * 0.5f), m));
+    }
+}
+
+// A perfect maze of n x n cells walled by one pixel thick lines, with a
+// small light in every eighth cell: long thin occluders that rays have to
+// squeeze past. Always the same layout.
+inline void load_maze(int n) {
+    scene_rng_t rnd = {4321};
+    n = std::max(n, 1);
+    float cw = static_cast<float>(scr_w) / n, ch = static_cast<float>(scr_h) / n;
+    // east and south walls per cell, carved by a depth first walk
+    std::vector<char> east(n * n, 1), south(n * n, 1), seen(n * n, 0);
+    std::vector<int> stack = {0};
+    seen[0] = 1;
+    while (!stack.empty()) {
+        int c = stack.back(), x = c % n, y = c / n;
+        int next[4], k = 0;
+        if (x > 0     && !seen[c - 1]) next[k++] = c - 1;
+        if (x < n - 1 && !seen[c + 1]) next[k++] = c + 1;
+        if (y > 0     && !seen[c - n]) next[k++] = c - n;
+        if (y < n - 1 && !seen[c + n]) next[k++] = c + n;
+        if (!k) {
+            stack.pop_back();
+            continue;
+        }
+        int d = next[std::min(k - 1, static_cast<int>(rnd() * k))];
+        if      (d == c + 1) east[c] = 0;
+        else if (d == c - 1) east[d] = 0;
+        else if (d == c + n) south[c] = 0;
+        else                 south[d] = 0;
+        seen[d] = 1;
+        stack.push_back(d);
+    }
+
+    material_t wall({0.3f, 0.3f, 0.3f, 1.0f}, 0.0f);
+    auto line = [&](float x0, float y0, float x1, float y1) {
+        objects.push_back(std::make_unique<Line>(vec2(x0, y0), vec2(x1, y1), 1.0f, wall));
+    };
+    line(0, 0.5f, scr_w, 0.5f);
+    line(0.5f, 0, 0.5f, scr_h);
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            float x1 = (x + 1) * cw - 0.5f, y1 = (y + 1) * ch - 0.5f;
+            if (east[y * n + x])  line(x1, y * ch, x1, (y + 1) * ch);
+            if (south[y * n + x]) line(x * cw, y1, (x + 1) * cw, y1);
+            if (rnd() < 0.125f)
+                objects.push_back(std::make_unique<Circle>(vec2((x + 0.5f) * cw, (y + 0.5f) * ch),
+                                                           std::max(1.0f, std::min(cw, ch) * 0.1f),
+                                                           material_t({rnd(), rnd(), rnd(), 1.0f}, 1.0f)));
+        }
+}
+
+// n tiny lights and nothing else, so most rays run their full length
+inline void load_emitters(int n) {
+    scene_rng_t rnd = {777};
+    for (int i = 0; i < n; ++i) {
+        float x = rnd() * scr_w;
+        float y = rnd() * scr_h;
+        float r = 0.75f + rnd();
+        material_t m({rnd(), rnd(), rnd(), 1.0f}, 0.5f + rnd());
+        objects.push_back(std::make_unique<Circle>(vec2(x, y), r, m));
+    }
+}
+
+inline bool is_builtin_scene(const std::string& name) {
+    for (const char* s : {"default", "scatter", "maze", "emitters"}) {
+        size_t n = strlen(s);
+        if (name.compare(0, n, s) == 0 && (name.size() == n || name[n] == ':')) return true;
+    }
+    return false;
+}
+
+// replaces `objects` with a built-in scene or a scene file, false if neither
+// works. "scatter:N" has N objects, "maze:N" N x N cells, "emitters:N" N lights.
+// Only the objects, see load_scene() for the rest.
+inline bool load_scene_objects(const std::string& name) {
+    objects.clear();
+    auto count = [&](size_t prefix, int fallback) {
+        return name.size() > prefix ? atoi(name.c_str() + prefix + 1) : fallback;
+    };
+    if      (!is_builtin_scene(name)) {
+        if (!load_scene_file(name, objects)) return false;
+    }
+    else if (name == "default")                  load_obj();
+    else if (name.compare(0, 7, "scatter") == 0) load_scatter(count(7, 20000));
+    else if (name.compare(0, 4, "maze") == 0)    load_maze(count(4, 16));
+    else                                         load_emitters(count(8, 2000));
+    return true;
+}
+
+// load_scene_objects(), then the BVH and shape tables the solver needs
+inline bool load_scene(const std::string& name) {
+    invalidate_scene();
+    if (!load_scene_objects(name)) return false;
+    scene_bvh.build(objects);
+    shape_store.build(objects);
+    return true;
+}
+
+#endif
@@ -0,0 +1,479 @@
+#ifndef SHAPE_STORE_H
+#define SHAPE_STORE_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "geometry.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SHAPE_SSE
+#endif
+
+// Shape parameters in per-type SoA tables, so the hot SDF loops run without
+// virtual calls and 4 lanes at a time. The Object classes stay the editing
+// front-end: the store mirrors them and is refreshed with build()/update()
+// whenever they change (scene_changes() and move_object() do that).
+//
+// Two batched kernels:
+//   min_sdf()    - every stored shape against one point, 4 shapes per step
+//   sdf_block()  - one shape against a block of pixels, 4 pixels per step
+// and a rasteriser, rasterise(), that finds the pixels with sdf <= 0
+// analytically and only evaluates the sdf near the edges.
+//
+// Every SDF is written once as a template over the lane type (float or f4)
+// with the exact operations of the Object::sdf() it mirrors, std::min/max
+// argument order included, so both widths give the virtual path's bits.
+
+enum shape_kinds { SHAPE_CIRCLE, SHAPE_RECT, SHAPE_TRIANGLE, SHAPE_LINE, SHAPE_KINDS };
+
+// lane helpers, f(a, b) behaves like std::f(a, b) also for -0 and NaN
+inline float lane_min(float a, float b) { return std::min(a, b); }
+inline float lane_max(float a, float b) { return std::max(a, b); }
+inline float lane_sqrt(float a)         { return std::sqrt(a); }
+inline float lane_abs(float a)          { return std::abs(a); }
+inline float lane_sign(float a)         { return a > 0.0f ? 1.0f : -1.0f; }
+
+#ifdef SHAPE_SSE
+struct f4 {
+    __m128 v;
+    f4() {}
+    f4(__m128 _v) : v(_v) {}
+    f4(float s) : v(_mm_set1_ps(s)) {}
+};
+inline f4 operator+(f4 a, f4 b) { return _mm_add_ps(a.v, b.v); }
+inline f4 operator-(f4 a, f4 b) { return _mm_sub_ps(a.v, b.v); }
+inline f4 operator*(f4 a, f4 b) { return _mm_mul_ps(a.v, b.v); }
+inline f4 operator/(f4 a, f4 b) { return _mm_div_ps(a.v, b.v); }
+// std::min(a, b) is b < a ? b : a, which is minps(b, a); same for max
+inline f4 lane_min(f4 a, f4 b) { return _mm_min_ps(b.v, a.v); }
+inline f4 lane_max(f4 a, f4 b) { return _mm_max_ps(b.v, a.v); }
+inline f4 lane_sqrt(f4 a)      { return _mm_sqrt_ps(a.v); }
+inline f4 lane_abs(f4 a)       { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline f4 lane_sign(f4 a) {
+    __m128 pos = _mm_cmpgt_ps(a.v, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(pos, _mm_set1_ps(1.0f)), _mm_andnot_ps(pos, _mm_set1_ps(-1.0f)));
+}
+#endif
+
+template <typename F>
+inline F circle_sdf(F px, F py, F cx, F cy, F r) {
+    F dx = px - cx, dy = py - cy;
+    return lane_sqrt(dx * dx + dy * dy) - r;
+}
+
+template <typename F>
+inline F rect_sdf(F px, F py, F cx, F cy, F hx, F hy) {
+    F dx = lane_abs(px - cx) - hx, dy = lane_abs(py - cy) - hy;
+    F ox = lane_max(dx, F(0.0f)), oy = lane_max(dy, F(0.0f));
+    return lane_sqrt(ox * ox + oy * oy) + lane_min(lane_max(dx, dy), F(0.0f));
+}
+
+template <typename F>
+inline F triangle_sdf(F px, F py, F ax, F ay, F bx, F by, F cx, F cy) {
+    F e0x = bx - ax, e0y = by - ay, v0x = px - ax, v0y = py - ay;
+    F e1x = cx - bx, e1y = cy - by, v1x = px - bx, v1y = py - by;
+    F e2x = ax - cx, e2y = ay - cy, v2x = px - cx, v2y = py - cy;
+
+    F t0 = lane_max(F(0.0f), lane_min(F(1.0f), (v0x * e0x + v0y * e0y) / (e0x * e0x + e0y * e0y)));
+    F t1 = lane_max(F(0.0f), lane_min(F(1.0f), (v1x * e1x + v1y * e1y) / (e1x * e1x + e1y * e1y)));
+    F t2 = lane_max(F(0.0f), lane_min(F(1.0f), (v2x * e2x + v2y * e2y) / (e2x * e2x + e2y * e2y)));
+    F q0x = v0x - e0x * t0, q0y = v0y - e0y * t0;
+    F q1x = v1x - e1x * t1, q1y = v1y - e1y * t1;
+    F q2x = v2x - e2x * t2, q2y = v2y - e2y * t2;
+
+    F s = e0x * e2y - e0y * e2x;
+    F d = lane_sqrt(lane_min(lane_min(q0x * q0x + q0y * q0y, q1x * q1x + q1y * q1y), q2x * q2x + q2y * q2y));
+    return d * lane_sign(s * (v0x * e2y - v0y * e2x));
+}
+
+template <typename F>
+inline F line_sdf(F px, F py, F ax, F ay, F bx, F by, F th) {
+    F pax = px - ax, pay = py - ay, bax = bx - ax, bay = by - ay;
+    F h = lane_max(F(0.0f), lane_min(F(1.0f), (pax * bax + pay * bay) / (bax * bax + bay * bay)));
+    F dx = pax - bax * h, dy = pay - bay * h;
+    return lane_sqrt(dx * dx + dy * dy) - th;
+}
+
+class shape_store_t {
+public:
+    shape_store_t() { clear(); }
+
+    // every object again, slots follow scene order within each kind
+    void build(const std::vector<std::unique_ptr<Object>>& objects) {
+        clear();
+        for (size_t i = 0; i < objects.size(); ++i) add(objects, static_cast<int>(i));
+    }
+
+    // keeps the capacity, per-tile subsets are refilled for every tile
+    void clear() {
+        for (int kind = 0; kind < SHAPE_KINDS; ++kind) {
+            tables[kind].p.resize(params(kind));
+            for (auto& col : tables[kind].p) col.clear();
+            tables[kind].id.clear();
+        }
+        slot_of.clear();
+    }
+
+    // appends object i of `objects`
+    void add(const std::vector<std::unique_ptr<Object>>& objects, int i) {
+        if (static_cast<int>(slot_of.size()) <= i) slot_of.resize(i + 1, {-1, -1});
+        int kind = kind_of(*objects[i]);
+        table_t& t = tables[kind];
+        slot_of[i] = {kind, static_cast<int>(t.id.size())};
+        t.id.push_back(i);
+        for (auto& col : t.p) col.push_back(0.0f);
+        store(*objects[i], kind, slot_of[i].second);
+    }
+
+    // appends the shape another store keeps for object i. Meant for per-tile
+    // subsets: only min_sdf() works on them, there is no slot lookup by index
+    void add(const shape_store_t& src, int i) {
+        int kind = src.slot_of[i].first, from = src.slot_of[i].second;
+        table_t& t = tables[kind];
+        t.id.push_back(i);
+        for (int k = 0; k < params(kind); ++k) t.p[k].push_back(src.tables[kind].p[k][from]);
+    }
+
+    // rereads the parameters of object i after an edit
+    void update(const std::vector<std::unique_ptr<Object>>& objects, int i) {
+        store(*objects[i], slot_of[i].first, slot_of[i].second);
+    }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const auto& t : tables) n += t.id.size();
+        return n;
+    }
+
+    // min of every stored sdf at (x, y), or `max` when none is lower
+    float min_sdf(float x, float y, float max) const {
+        float best = max;
+        for (int kind = 0; kind < SHAPE_KINDS; ++kind) {
+            const table_t& t = tables[kind];
+            int n = static_cast<int>(t.id.size()), s = 0;
+#ifdef SHAPE_SSE
+            __m128 lo = _mm_set1_ps(best);
+            for (; s + 4 <= n; s += 4) {
+                f4 d = eval<f4>(kind, f4(x), f4(y), [&](int k) { return f4(_mm_loadu_ps(&t.p[k][s])); });
+                lo = _mm_min_ps(d.v, lo);
+            }
+            float lanes[4];
+            _mm_storeu_ps(lanes, lo);
+            for (float v : lanes) if (v < best) best = v;
+#endif
+            for (; s < n; ++s) {
+                float d = eval<float>(kind, x, y, [&](int k) { return t.p[k][s]; });
+                if (d < best) best = d;
+            }
+        }
+        return best;
+    }
+
+    // sdf of object i over the pixels of r, column by column: pixel (x, y) goes
+    // to out[(x - r.x0) * stride + y - r.y0]. Whole groups of 4 are written,
+    // stride has to be r.y1 - r.y0 rounded up to 4.
+    void sdf_block(int i, const rect_t& r, int stride, float* out) const {
+        int kind = slot_of[i].first, s = slot_of[i].second;
+        float par[6];
+        for (int k = 0; k < params(kind); ++k) par[k] = tables[kind].p[k][s];
+        switch (kind) {
+            case SHAPE_CIRCLE:   block<SHAPE_CIRCLE>(par, r, stride, out);   break;
+            case SHAPE_RECT:     block<SHAPE_RECT>(par, r, stride, out);     break;
+            case SHAPE_TRIANGLE: block<SHAPE_TRIANGLE>(par, r, stride, out); break;
+            default:             block<SHAPE_LINE>(par, r, stride, out);     break;
+        }
+    }
+
+    // Calls span(x, y0, y1) for the runs [y0, y1) of every column x of r where
+    // the sdf of object i is <= 0: the same pixels sdf_block() gives, down to
+    // the rounding. Each column is bracketed analytically (circle and capsule
+    // spans, rectangle fills, the triangle's edge function) with a margin for
+    // the float rounding on both sides; pixels inside the inner bracket are
+    // filled blindly and only the ones in the margin get the sdf. Runs of a
+    // column come in no particular order and may touch.
+    template <typename S>
+    void rasterise(int i, const rect_t& r, S span) const {
+        int kind = slot_of[i].first, s = slot_of[i].second;
+        float par[6];
+        for (int k = 0; k < params(kind); ++k) par[k] = tables[kind].p[k][s];
+        switch (kind) {
+            case SHAPE_CIRCLE:   raster<SHAPE_CIRCLE>(par, r, span);   break;
+            case SHAPE_RECT:     raster<SHAPE_RECT>(par, r, span);     break;
+            case SHAPE_TRIANGLE: raster<SHAPE_TRIANGLE>(par, r, span); break;
+            default:             raster<SHAPE_LINE>(par, r, span);     break;
+        }
+    }
+
+private:
+    // one column per parameter, `id` is the object index of every slot
+    struct table_t {
+        std::vector<std::vector<float>> p;
+        std::vector<int>                id;
+    };
+    table_t tables[SHAPE_KINDS];
+    std::vector<std::pair<int, int>> slot_of;  // object index -> (kind, slot)
+
+    static int params(int kind) {
+        switch (kind) {
+            case SHAPE_CIRCLE:   return 3;  // cx, cy, r
+            case SHAPE_RECT:     return 4;  // cx, cy, half size x, y
+            case SHAPE_TRIANGLE: return 6;  // p0, p1, p2
+            default:             return 5;  // start, end, thickness
+        }
+    }
+
+    static int kind_of(const Object& o) {
+        switch (o.shape) {
+            case CIRCLE:    return SHAPE_CIRCLE;
+            case RECTANGLE: return SHAPE_RECT;
+            case TRIANGLE:  return SHAPE_TRIANGLE;
+            default:        return SHAPE_LINE;
+        }
+    }
+
+    void store(const Object& o, int kind, int s) {
+        auto& p = tables[kind].p;
+        auto set = [&](std::initializer_list<float> v) {
+            int k = 0;
+            for (float f : v) p[k++][s] = f;
+        };
+        switch (kind) {
+            case SHAPE_CIRCLE: {
+                const Circle& c = static_cast<const Circle&>(o);
+                set({c.centre.x, c.centre.y, c.radius});
+                break;
+            }
+            case SHAPE_RECT: {
+                const Rectangle& r = static_cast<const Rectangle&>(o);
+                set({r.centre.x, r.centre.y, r.size.x, r.size.y});
+                break;
+            }
+            case SHAPE_TRIANGLE: {
+                const Triangle& t = static_cast<const Triangle&>(o);
+                set({t.p0.x, t.p0.y, t.p1.x, t.p1.y, t.p2.x, t.p2.y});
+                break;
+            }
+            default: {
+                const Line& l = static_cast<const Line&>(o);
+                set({l.start.x, l.start.y, l.end.x, l.end.y, l.thickness});
+                break;
+            }
+        }
+    }
+
+    // sdf of one kind at (x, y), `p(k)` gives parameter k in the lane type
+    template <typename F, typename P>
+    static F eval(int kind, F x, F y, P p) {
+        switch (kind) {
+            case SHAPE_CIRCLE:   return circle_sdf<F>(x, y, p(0), p(1), p(2));
+            case SHAPE_RECT:     return rect_sdf<F>(x, y, p(0), p(1), p(2), p(3));
+            case SHAPE_TRIANGLE: return triangle_sdf<F>(x, y, p(0), p(1), p(2), p(3), p(4), p(5));
+            default:             return line_sdf<F>(x, y, p(0), p(1), p(2), p(3), p(4));
+        }
+    }
+
+    // [lo, hi] of the y in column x whose distance to the segment a-b is at
+    // most R, lo > hi for none; a capsule is convex, so one interval
+    static void capsule_range(double ax, double ay, double bx, double by, double R, double x, double& lo, double& hi) {
+        lo = INFINITY;
+        hi = -INFINITY;
+        if (!(R >= 0)) return;
+        auto add = [&](double l, double h) {
+            if (l > h) return;
+            lo = std::min(lo, l);
+            hi = std::max(hi, h);
+        };
+        auto disk = [&](double cx, double cy) {
+            double h2 = R * R - (x - cx) * (x - cx);
+            if (h2 >= 0) add(cy - std::sqrt(h2), cy + std::sqrt(h2));
+        };
+        disk(ax, ay);
+        disk(bx, by);
+        double L = std::sqrt((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+        if (L == 0) return;
+        double ux = (bx - ax) / L, uy = (by - ay) / L;
+        // c0 + c1 * y within [a, b], narrowing [l, h]
+        double l = -INFINITY, h = INFINITY;
+        auto within = [&](double c0, double c1, double a, double b) {
+            if (c1 == 0) {
+                if (c0 < a || c0 > b) h = -INFINITY;
+                return;
+            }
+            double y0 = (a - c0) / c1, y1 = (b - c0) / c1;
+            l = std::max(l, std::min(y0, y1));
+            h = std::min(h, std::max(y0, y1));
+        };
+        within((x - ax) * ux - ay * uy, uy, 0, L);      // along the segment
+        within((x - ax) * uy + ay * ux, -ux, -R, R);    // across it
+        add(l, h);
+    }
+
+    // false for shapes the brackets below do not hold for (non-finite or
+    // degenerate), whose pixels all get the sdf
+    static bool regular(int kind, const float* p) {
+        for (int k = 0; k < params(kind); ++k)
+            if (!std::isfinite(p[k])) return false;
+        if (kind != SHAPE_TRIANGLE) return true;
+        float e0x = p[2] - p[0], e0y = p[3] - p[1], e1x = p[4] - p[2], e1y = p[5] - p[3];
+        float e2x = p[0] - p[4], e2y = p[1] - p[5];
+        return static_cast<double>(e0x) * e2y - static_cast<double>(e0y) * e2x != 0 &&
+               (e0x != 0 || e0y != 0) && (e1x != 0 || e1y != 0) && (e2x != 0 || e2y != 0);
+    }
+
+    // [lo, hi] of the y in column x where the sdf of a regular shape is at
+    // most t (lo > hi for none), up to the rounding of the float sdf
+    template <int KIND>
+    static void column_range(const float* p, double x, double t, double& lo, double& hi) {
+        lo = INFINITY;
+        hi = -INFINITY;
+        if (KIND == SHAPE_CIRCLE) {
+            double R = p[2] + t, h2 = R * R - (x - p[0]) * (x - p[0]);
+            if (R >= 0 && h2 >= 0) {
+                double h = std::sqrt(h2);
+                lo = p[1] - h;
+                hi = p[1] + h;
+            }
+        }
+        else if (KIND == SHAPE_RECT) {
+            // sdf <= t needs both axes within t of the box, and for t < 0 that suffices
+            if (std::abs(x - p[0]) - p[2] <= t && p[3] + t >= 0) {
+                lo = p[1] - (p[3] + t);
+                hi = p[1] + (p[3] + t);
+            }
+        }
+        else if (KIND == SHAPE_TRIANGLE) {
+            // the sign of the sdf comes from edge c-a alone: sdf <= 0 on the
+            // side of that edge's line where s * cross(p - a, a - c) <= 0
+            double ax = p[0], ay = p[1], e0x = p[2] - ax, e0y = p[3] - ay, e2x = ax - p[4], e2y = ay - p[5];
+            double s = e0x * e2y - e0y * e2x, len = std::sqrt(e2x * e2x + e2y * e2y);
+            // k * y + m <= T
+            double k = -s * e2x, m = s * ((x - ax) * e2y + ay * e2x), T = t * std::abs(s) * len;
+            if (k == 0) {
+                if (m <= T) { lo = -INFINITY; hi = INFINITY; }
+            }
+            else if (k > 0) { lo = -INFINITY; hi = (T - m) / k; }
+            else            { lo = (T - m) / k; hi = INFINITY; }
+        }
+        else
+            capsule_range(p[0], p[1], p[2], p[3], p[4] + t, x, lo, hi);
+    }
+
+    template <int KIND, typename S>
+    static void raster(const float* par, const rect_t& r, S& span) {
+        double scale = std::max({std::abs(r.x0), std::abs(r.x1), std::abs(r.y0), std::abs(r.y1)});
+        for (int k = 0; k < params(KIND); ++k) scale = std::max(scale, static_cast<double>(std::abs(par[k])));
+        // far above the few ulps the float sdf can be off by
+        const double eps = 1.0 / 16 + scale / 65536;
+        const bool   analytic = regular(KIND, par);
+
+        for (int x = r.x0; x < r.x1; ++x) {
+            int  run = 0;           // start of the open run
+            bool open = false;
+            auto flush = [&](int y) {
+                if (open) span(x, run, y);
+                open = false;
+            };
+            // the sdf for [y0, y1), 64 rows at a time into a mask whose runs
+            // continue the open one; 4 pixels per step like sdf_block()
+            auto test = [&](int y0, int y1) {
+                for (int c = y0; c < y1; c += 64) {
+                    int      n = std::min(64, y1 - c), k = 0;
+                    uint64_t m = 0;
+#ifdef SHAPE_SSE
+                    // padded to 4 like sdf_block(), the lanes past n are dropped
+                    for (; k < n; k += 4) {
+                        f4 py = _mm_add_ps(_mm_set1_ps(static_cast<float>(c + k)), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+                        f4 d  = eval<f4>(KIND, f4(static_cast<float>(x)), py, [&](int j) { return f4(par[j]); });
+                        m |= static_cast<uint64_t>(_mm_movemask_ps(_mm_cmple_ps(d.v, _mm_setzero_ps()))) << k;
+                    }
+                    if (n < 64) m &= (uint64_t(1) << n) - 1;
+#endif
+                    for (; k < n; ++k)
+                        if (eval<float>(KIND, static_cast<float>(x), static_cast<float>(c + k), [&](int j) { return par[j]; }) <= 0)
+                            m |= uint64_t(1) << k;
+                    for (int pos = 0; pos < n; ) {
+                        if (open) {
+                            uint64_t out = ~m >> pos;   // ones past n end the run there
+                            pos = out ? pos + __builtin_ctzll(out) : 64;
+                            if (pos < n) flush(c + pos);
+                        }
+                        else {
+                            uint64_t in = m >> pos;
+                            if (!in) break;
+                            pos += __builtin_ctzll(in);
+                            run  = c + pos;
+                            open = true;
+                        }
+                    }
+                }
+            };
+            // the pixels [p0, p1) of [lo, hi] in the column, clipped to r
+            auto pixels = [&](double lo, double hi, int& p0, int& p1) {
+                double y0 = r.y0, y1 = r.y1;
+                if (!(lo <= hi) || lo > y1 || hi < y0) {
+                    p0 = p1 = r.y0;
+                    return;
+                }
+                p0 = static_cast<int>(std::ceil(std::max(lo, y0)));
+                p1 = static_cast<int>(std::floor(std::min(hi, y1 - 1))) + 1;
+                if (p1 < p0) p1 = p0;
+            };
+
+            if (!analytic) {
+                test(r.y0, r.y1);
+                flush(r.y1);
+                continue;
+            }
+            double ilo, ihi, olo, ohi;
+            column_range<KIND>(par, x, -eps, ilo, ihi);
+            column_range<KIND>(par, x, eps, olo, ohi);
+            int out0, out1, in0, in1;
+            pixels(olo, ohi, out0, out1);
+            pixels(ilo, ihi, in0, in1);
+            in0 = std::min(std::max(in0, out0), out1);
+            in1 = std::min(std::max(in1, in0), out1);
+            if (in0 == in1) in0 = in1 = out0;
+
+            test(out0, in0);
+            if (in0 < in1 && !open) { run = in0; open = true; }
+            test(in1, out1);
+            flush(out1);
+
+            // the triangle's sdf is also 0 right on its two other edges,
+            // wherever they run
+            if (KIND == SHAPE_TRIANGLE)
+                for (int e = 0; e < 2; ++e) {
+                    double lo, hi;
+                    capsule_range(par[2 * e], par[2 * e + 1], par[2 * e + 2], par[2 * e + 3], eps, x, lo, hi);
+                    int e0, e1;
+                    pixels(lo, hi, e0, e1);
+                    test(e0, std::min(e1, out0));
+                    flush(std::min(e1, out0));
+                    test(std::max(e0, out1), e1);
+                    flush(e1);
+                }
+        }
+    }
+
+    template <int KIND>
+    static void block(const float* par, const rect_t& r, int stride, float* out) {
+        for (int x = r.x0; x < r.x1; ++x) {
+            float* col = out + (x - r.x0) * stride;
+            int    y = r.y0;
+#ifdef SHAPE_SSE
+            f4 px(static_cast<float>(x));
+            for (; y < r.y1; y += 4) {
+                f4 py = _mm_add_ps(_mm_set1_ps(static_cast<float>(y)), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+                _mm_storeu_ps(col + (y - r.y0), eval<f4>(KIND, px, py, [&](int k) { return f4(par[k]); }).v);
+            }
+#endif
+            for (; y < r.y1; ++y)
+                col[y - r.y0] = eval<float>(KIND, static_cast<float>(x), static_cast<float>(y), [&](int k) { return par[k]; });
+        }
+    }
+};
+
+#endif
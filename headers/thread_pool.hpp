@@ -0,0 +1,181 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A rectangle of work [x0, x1) x [y0, y1)
+struct tile_t {
+    int x0, y0, x1, y1;
+};
+
+inline int tile_count(int w, int h, int tile) {
+    return ((w + tile - 1) / tile) * ((h + tile - 1) / tile);
+}
+
+inline tile_t tile_rect(int i, int w, int h, int tile) {
+    int tiles_x = (w + tile - 1) / tile;
+    int x0 = (i % tiles_x) * tile;
+    int y0 = (i / tiles_x) * tile;
+    return {x0, y0, x0 + tile < w ? x0 + tile : w, y0 + tile < h ? y0 + tile : h};
+}
+
+// the same over an area that does not start at (0, 0)
+inline int tile_count(const tile_t& area, int tile) {
+    if (area.x1 <= area.x0 || area.y1 <= area.y0) return 0;
+    return tile_count(area.x1 - area.x0, area.y1 - area.y0, tile);
+}
+
+inline tile_t tile_rect(int i, const tile_t& area, int tile) {
+    tile_t t = tile_rect(i, area.x1 - area.x0, area.y1 - area.y0, tile);
+    return {t.x0 + area.x0, t.y0 + area.y0, t.x1 + area.x0, t.y1 + area.y0};
+}
+
+// Fixed set of workers running parallel_for() jobs. Every worker starts with a
+// contiguous share of the tiles and, once it runs dry, steals the back half of
+// another worker's share, so tiles that finish early (rays stopping on nearby
+// occluders) do not leave cores idle.
+//
+// Tiles must write disjoint outputs, so the result never depends on scheduling.
+// With `deterministic` set stealing is disabled and every tile always runs on the
+// same worker, which also makes per-worker scratch and statistics reproducible.
+class thread_pool {
+public:
+    bool deterministic = false;
+
+    explicit thread_pool(int threads = 0) { resize(threads); }
+    ~thread_pool() { stop(); }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // 0 - one worker per hardware thread; the calling thread counts as worker 0
+    void resize(int threads) {
+        stop();
+        if (threads <= 0) threads = static_cast<int>(std::thread::hardware_concurrency());
+        if (threads <= 0) threads = 1;
+
+        ranges = std::vector<range_t>(threads);
+        stopping = false;
+        for (int i = 1; i < threads; ++i)
+            workers.emplace_back(&thread_pool::worker_main, this, i, generation);
+    }
+
+    int size() const { return static_cast<int>(ranges.size()); }
+
+    // calls fn(tile, worker) for every tile in [0, n_tiles) and waits for all of them
+    void parallel_for(int n_tiles, const std::function<void(int, int)>& fn) {
+        if (n_tiles <= 0) return;
+        if (size() == 1 || n_tiles == 1) {
+            for (int t = 0; t < n_tiles; ++t) fn(t, 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(m);
+            job = &fn;
+            int n = size();
+            for (int i = 0; i < n; ++i) {
+                std::lock_guard<std::mutex> rl(ranges[i].lock);
+                ranges[i].begin = static_cast<int>(static_cast<long long>(n_tiles) * i / n);
+                ranges[i].end   = static_cast<int>(static_cast<long long>(n_tiles) * (i + 1) / n);
+            }
+            pending = n - 1;
+            ++generation;
+        }
+        wake.notify_all();
+
+        run(0);
+
+        std::unique_lock<std::mutex> lk(m);
+        done.wait(lk, [this] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct range_t {
+        std::mutex lock;
+        int begin = 0, end = 0;
+    };
+
+    std::vector<range_t>     ranges;
+    std::vector<std::thread> workers;
+    std::mutex               m;
+    std::condition_variable  wake, done;
+    std::atomic<int>         pending{0};
+    unsigned long long       generation = 0;
+    bool                     stopping = false;
+    const std::function<void(int, int)>* job = nullptr;
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) w.join();
+        workers.clear();
+    }
+
+    void worker_main(int id, unsigned long long seen) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(m);
+                wake.wait(lk, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            run(id);
+            if (pending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lk(m);
+                done.notify_all();
+            }
+        }
+    }
+
+    bool pop(int id, int& tile) {
+        std::lock_guard<std::mutex> lk(ranges[id].lock);
+        if (ranges[id].begin >= ranges[id].end) return false;
+        tile = ranges[id].begin++;
+        return true;
+    }
+
+    bool steal(int id) {
+        int n = size();
+        for (int k = 1; k < n; ++k) {
+            range_t& victim = ranges[(id + k) % n];
+            int begin, end;
+            {
+                std::lock_guard<std::mutex> lk(victim.lock);
+                int left = victim.end - victim.begin;
+                if (left <= 0) continue;
+                begin = victim.end - (left + 1) / 2;
+                end   = victim.end;
+                victim.end = begin;
+            }
+            std::lock_guard<std::mutex> lk(ranges[id].lock);
+            ranges[id].begin = begin;
+            ranges[id].end   = end;
+            return true;
+        }
+        return false;
+    }
+
+    void run(int id) {
+        int tile;
+        for (;;) {
+            if (pop(id, tile)) {
+                (*job)(tile, id);
+                continue;
+            }
+            if (deterministic || !steal(id)) break;
+        }
+    }
+};
+
+#endif
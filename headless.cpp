@@ -0,0 +1,311 @@
+//
+//  headless.cpp
+//  Offline Radiance Cascades renderer: runs compute() once and writes the
+//  buffers to disk, no window is ever opened (--present only uses the dummy
+//  video driver).
+//
+#include <SDL3/SDL.h>
+#include "headers/geometry.hpp"
+#include "headers/radiance.hpp"
+#include "headers/scenes.hpp"
+#include "headers/image_io.hpp"
+#include "headers/present.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+void usage() {
+    printf("usage: rc_headless [options]\n"
+           "  -o FILE            lighting output (.png, .ppm or .pfm), default light.png\n"
+           "  --dist FILE        also write the distance field\n"
+           "  --rc PREFIX        also write every cascade as PREFIX<n>.pfm\n"
+           "  --scene NAME       built-in scene: default, scatter (20000 small objects),\n"
+           "                     maze (16x16 cells), emitters (2000 lights), each with\n"
+           "                     :N for another count, or a scene file (.rcs or text)\n"
+           "  -w W, -h H         resolution, default 512x512 or the size of the scene file\n"
+           "  --d0 N --r0 N --rl0 N            cascade 0 probe spacing, rays, ray length\n"
+           "  --s-res N --a-res N --len-res N  spatial, angular and ray length factors\n"
+           "  --cascades N       number of cascades, default derived from the diagonal\n"
+           "  --rc-format f32|f16|rgb9e5     storage of the cascade rays, default f32\n"
+           "  --light-format f32|f16|rgb9e5  storage of the lighting, default f32\n"
+           "  --light-scale N    gather the lighting for one pixel in N x N (up to 8) and\n"
+           "                     interpolate the rest away from objects, default 1\n"
+           "  --amortise K0,K1,..  refresh cascade n over Kn frames after an edit, default 1\n"
+           "  --ray-budget N     most rays the amortised cascades trace per frame, 0 = no cap\n"
+           "  --history F        share of the old value a refreshed ray keeps, default 0\n"
+           "  --dist-mode edt|analytic\n"
+           "  --mip              march over a min pyramid of the distance field\n"
+           "  --cells            march over distance and material packed in 4 bytes a pixel\n"
+           "  --tracer sphere|dda|auto  sphere tracing, DDA through the occupied pixels\n"
+           "                     without a distance field, or the faster per cascade\n"
+           "  --solver rc|hrc    classic or holographic radiance cascades, default rc\n"
+           "  --hrc-d0 N         pixels between HRC probes, default 1\n"
+           "  -t N               worker threads, 0 = all\n"
+           "  -d                 deterministic scheduling\n"
+           "  --simd scalar|sse|avx2  packet marcher, default the best the CPU supports\n"
+           "  --compare-simd     also time the scalar marcher and report its difference\n"
+           "  --move N DX DY     then move object N and time the incremental frame, and\n"
+           "                     the frames after it until amortised cascades settle\n"
+           "  --present N        time N viewer presents on the dummy video driver\n"
+           "  --profile PREFIX   count the marching per cascade and write every stage of\n"
+           "                     every frame to PREFIX.csv and PREFIX.json (Chrome trace)\n");
+}
+
+image_t light_image() {
+    image_t img(scr_w, scr_h);
+    for (int x = 0; x < scr_w; ++x)
+        for (int y = 0; y < scr_h; ++y) {
+            SDL_FColor c = buf_light.at(px(x, y));
+            float* o = img.at(x, y);
+            o[0] = c.r; o[1] = c.g; o[2] = c.b;
+        }
+    return img;
+}
+
+// 8-bit formats get the same diagonal normalisation as the viewer, .pfm keeps pixels
+image_t dist_image(bool normalise) {
+    image_t img(scr_w, scr_h);
+    for (int x = 0; x < scr_w; ++x)
+        for (int y = 0; y < scr_h; ++y) {
+            float d = buf_dist[px(x, y)];
+            if (normalise) d /= diagonal;
+            float* o = img.at(x, y);
+            o[0] = o[1] = o[2] = d;
+        }
+    return img;
+}
+
+image_t cascade_image(int Cn) {
+    image_t img(ray_w, ray_h);
+    for (int x = 0; x < ray_w; ++x)
+        for (int y = 0; y < ray_h; ++y) {
+            SDL_FColor c = buf_rc[Cn].at(x, y);
+            float* o = img.at(x, y);
+            o[0] = c.r; o[1] = c.g; o[2] = c.b;
+        }
+    return img;
+}
+
+// HRC levels are listed as cascades: level 0 includes the marching, the
+// others are ray extension
+void print_stage_times(const char* title, double total) {
+    int n = static_cast<int>(stage_times.cascade.size());
+    const char* what = solver == SOLVER_HRC ? "level" : "cascade";
+    printf("%s (%dx%d, %d %ss):\n", title, scr_w, scr_h, n, what);
+    printf("  %-12s %10.3f ms\n", "objects", stage_times.obj);
+    printf("  %-12s %10.3f ms\n", "distance", stage_times.dist);
+    for (int i = n - 1; i >= 0; --i) {
+        printf("  %-7s %-4d %10.3f ms", what, i, stage_times.cascade[i]);
+        // the marching counters of the cascade, complete while profiling
+        if (profiling && solver == SOLVER_RC && stage_times.counters[i].rays > 0) {
+            const profile_counters_t& c = stage_times.counters[i];
+            printf("  %9ld rays, %5.2f lookups per ray, %4ld at most, %5.1f%% hit", c.rays,
+                   static_cast<double>(c.steps) / c.rays, c.max_steps, 100.0 * c.hits / c.rays);
+        }
+        printf("\n");
+    }
+    printf("  %-12s %10.3f ms\n", "merge", stage_times.merge);
+    printf("  %-12s %10.3f ms\n", "total", total);
+    const rect_t& d = stage_times.dirty;
+    printf("  redone [%d, %d) x [%d, %d), %ld rays, %.2f per pixel\n", d.x0, d.x1, d.y0, d.y1, stage_times.rays,
+           static_cast<double>(stage_times.rays) / (static_cast<double>(scr_w) * scr_h));
+    if (stage_times.rays > 0)
+        printf("  %ld distance lookups, %.2f per ray\n", stage_times.steps, static_cast<double>(stage_times.steps) / stage_times.rays);
+    if (stage_times.pending > 0) printf("  %ld rays of amortised cascades pending\n", stage_times.pending);
+}
+
+// one compute() as a profiled frame, returns its wall time
+double run_frame() {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    {
+        profile_scope_t scope("frame");
+        compute(true);
+    }
+    ++profile_frame;
+    return ms_since(t0);
+}
+
+// runs frames without edits until the amortised cascades have traced every
+// pending ray, one line per frame
+void settle() {
+    const int max_frames = 10000;
+    int frames = 0;
+    double total = 0;
+    long rays = 0;
+    while (stage_times.pending > 0 && frames < max_frames) {
+        double ms = run_frame();
+        ++frames;
+        total += ms;
+        rays  += stage_times.rays;
+        printf("  amortised frame %-4d %10.3f ms, %ld rays, %ld pending\n", frames, ms, stage_times.rays, stage_times.pending);
+    }
+    if (frames > 0)
+        printf("Settled after %d more frames, %.3f ms and %ld rays in total\n", frames, total, rays);
+}
+
+// the viewer's presentation path with every layer on, software renderer and
+// dummy video driver so it runs anywhere
+bool time_present(int frames) {
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "dummy");
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        return false;
+    }
+    SDL_Window*   window   = SDL_CreateWindow("rc_headless", scr_w, scr_h, 0);
+    SDL_Renderer* renderer = window ? SDL_CreateRenderer(window, "software") : nullptr;
+    if (!renderer || !init_present(renderer)) {
+        fprintf(stderr, "Could not set up the software renderer: %s\n", SDL_GetError());
+        if (renderer) SDL_DestroyRenderer(renderer);
+        if (window) SDL_DestroyWindow(window);
+        SDL_Quit();
+        return false;
+    }
+
+    present_layers_t layers;
+    layers.dist = layers.light = layers.objects = true;
+    double fill = 0.0, total = 0.0;
+    for (int i = 0; i < frames; ++i) {
+        profile_scope_t scope("present");
+        Uint64 t0 = SDL_GetPerformanceCounter();
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
+        void* pixels;
+        int   pitch;
+        Uint64 t1 = SDL_GetPerformanceCounter();
+        if (SDL_LockTexture(present_tex, nullptr, &pixels, &pitch)) {
+            fill_present(layers, static_cast<Uint8*>(pixels), pitch);
+            SDL_UnlockTexture(present_tex);
+        }
+        fill += ms_since(t1);
+        SDL_FRect dst = {0.0f, 0.0f, static_cast<float>(scr_w), static_cast<float>(scr_h)};
+        SDL_RenderTexture(renderer, present_tex, nullptr, &dst);
+        SDL_RenderPresent(renderer);
+        total += ms_since(t0);
+    }
+    printf("present: %.3f ms per frame, %.3f ms of it compositing (%d frames)\n",
+           total / frames, fill / frames, frames);
+
+    free_present();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return true;
+}
+
+bool save(const string& path, const image_t& img) {
+    if (write_image(path, img)) return true;
+    fprintf(stderr, "Could not write %s\n", path.c_str());
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    string out = "light.png", dist_out, rc_prefix, profile_prefix, scene = "default";
+    int cascades = 0;
+    bool compare_simd = false, size_given = false;
+    int move_obj = -1, present_frames = 0;
+    float move_x = 0, move_y = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if      (a == "-o"          && has_val) out = argv[++i];
+        else if (a == "--dist"      && has_val) dist_out = argv[++i];
+        else if (a == "--rc"        && has_val) rc_prefix = argv[++i];
+        else if (a == "--scene"     && has_val) scene = argv[++i];
+        else if (a == "-w"          && has_val) { scr_w = atoi(argv[++i]); size_given = true; }
+        else if (a == "-h"          && has_val) { scr_h = atoi(argv[++i]); size_given = true; }
+        else if (a == "--d0"        && has_val) d0 = atoi(argv[++i]);
+        else if (a == "--r0"        && has_val) r0 = atoi(argv[++i]);
+        else if (a == "--rl0"       && has_val) rl0 = atoi(argv[++i]);
+        else if (a == "--s-res"     && has_val) s_res_factor = atoi(argv[++i]);
+        else if (a == "--a-res"     && has_val) a_res_factor = atoi(argv[++i]);
+        else if (a == "--len-res"   && has_val) ray_len_factor = atoi(argv[++i]);
+        else if (a == "--cascades"  && has_val) cascades = atoi(argv[++i]);
+        else if (a == "--rc-format" && has_val) cascade_format = parse_color_format(argv[++i]);
+        else if (a == "--light-format" && has_val) light_format = parse_color_format(argv[++i]);
+        else if (a == "--light-scale" && has_val) light_scale = atoi(argv[++i]);
+        else if (a == "--amortise"  && has_val) {
+            cascade_period.clear();
+            for (char* p = argv[++i]; *p; ) {
+                cascade_period.push_back(static_cast<int>(strtol(p, &p, 10)));
+                if (*p == ',') ++p;
+                else if (*p) break;
+            }
+        }
+        else if (a == "--ray-budget" && has_val) ray_budget = atol(argv[++i]);
+        else if (a == "--history"   && has_val) history_blend = atof(argv[++i]);
+        else if (a == "--dist-mode" && has_val) dist_mode = !strcmp(argv[++i], "analytic") ? DIST_ANALYTIC : DIST_EDT;
+        else if (a == "--mip")                  march_mip = true;
+        else if (a == "--cells")                march_cells = true;
+        else if (a == "--tracer"    && has_val) {
+            string v = argv[++i];
+            tracer_mode = v == "auto" ? TRACER_AUTO : v == "dda" ? TRACER_DDA : TRACER_SPHERE;
+        }
+        else if (a == "--solver"    && has_val) solver = !strcmp(argv[++i], "hrc") ? SOLVER_HRC : SOLVER_RC;
+        else if (a == "--hrc-d0"    && has_val) hrc_d0 = atoi(argv[++i]);
+        else if (a == "-t"          && has_val) n_threads = atoi(argv[++i]);
+        else if (a == "-d")                     deterministic = true;
+        else if (a == "--simd"      && has_val) {
+            string v = argv[++i];
+            march_simd = v == "avx2" ? SIMD_AVX2 : v == "sse" ? SIMD_SSE : SIMD_SCALAR;
+        }
+        else if (a == "--compare-simd")         compare_simd = true;
+        else if (a == "--present"   && has_val) present_frames = atoi(argv[++i]);
+        else if (a == "--profile"   && has_val) profile_prefix = argv[++i];
+        else if (a == "--move"      && i + 3 < argc) {
+            move_obj = atoi(argv[++i]);
+            move_x = atof(argv[++i]);
+            move_y = atof(argv[++i]);
+        }
+        else {
+            usage();
+            return a == "--help" ? 0 : 1;
+        }
+    }
+    if (scr_w <= 0 || scr_h <= 0 || d0 <= 0 || r0 <= 0 || rl0 <= 0 || hrc_d0 <= 0 ||
+        s_res_factor < 2 || a_res_factor < 1 || ray_len_factor < 2 || ray_budget < 0 || light_scale < 1 ||
+        history_blend < 0 || history_blend >= 1) {
+        fprintf(stderr, "Invalid resolution or cascade configuration\n");
+        return 1;
+    }
+
+    int file_w, file_h;
+    if (!size_given && !is_builtin_scene(scene) && scene_file_size(scene, file_w, file_h)) {
+        scr_w = file_w;
+        scr_h = file_h;
+    }
+
+    if (!init_solver(cascades)) return 1;
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    if (!load_scene(scene)) {
+        fprintf(stderr, "Could not load scene \"%s\"\n", scene.c_str());
+        return 1;
+    }
+    printf("Scene: %zu objects, loaded and indexed in %.3f ms\n", objects.size(), ms_since(t0));
+
+    if (!profile_prefix.empty()) profile_start();
+    print_stage_times("Stage times", run_frame());
+
+    if (move_obj >= 0 && move_obj < static_cast<int>(objects.size())) {
+        objects[move_obj]->centre = objects[move_obj]->centre + vec2(move_x, move_y);
+        print_stage_times("Incremental frame", run_frame());
+        settle();
+        compare_incremental();
+    }
+
+    bool ok = save(out, light_image());
+    if (!dist_out.empty())
+        ok &= save(dist_out, dist_image(dist_out.size() < 4 || dist_out.compare(dist_out.size() - 4, 4, ".pfm") != 0));
+    if (!rc_prefix.empty())
+        for (int i = 0; i <= max_cascade; ++i)
+            ok &= save(rc_prefix + to_string(i) + ".pfm", cascade_image(i));
+
+    if (compare_simd) compare_march_modes();
+    if (present_frames > 0) ok &= time_present(present_frames);
+    if (!profile_prefix.empty()) ok &= write_profile(profile_prefix);
+
+    free_solver();
+    return ok ? 0 : 1;
+}
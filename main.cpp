@@ -6,9 +6,14 @@
 //
 #include <SDL3/SDL.h>
 #include "headers/geometry.hpp"
+#include "headers/radiance.hpp"
+#include "headers/scenes.hpp"
+#include "headers/present.hpp"
+#include "headers/pipeline.hpp"
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <cstring>
 
 #define DEBUGG
 #define SHOW_FPS
@@ -16,240 +21,28 @@
 
 #define WIND_W      512
 #define WIND_H      512
-float diagonal = std::sqrt(WIND_W * WIND_W + WIND_H * WIND_H);
 
 SDL_Event event;
 float mouse_x = 0, mouse_y = 0;
 bool quit = false;
 
-#define TAU     6.28319
-// d0              - distance b/w the probes in cascade 0
-// r0              - num of rays of a probe in cascade 0
-// rl0             - length of a ray in cascade 0
-int d0 = 64, r0 = 4, rl0 = 16;
-// s_res_factor    - spatial resolution factor
-// a_res_factor    - angular resolution factor
-// ray_len_factor  - ray length resolution factor
-int s_res_factor = 2, a_res_factor = 4, ray_len_factor = 3;
-int max_cascade = 1;
-// int d0 = 1, r0 = 4, rl0 = 2;
-// int s_res_factor = 2, a_res_factor = 4, ray_len_factor = 4;
-// int max_cascade = 5;
-
 bool render_rays_RC = 1, render_rays_HRC = 0;
 bool render_dist_map = 0, render_objects = 1;
 bool render_cascade = 0;
 bool render_illumination = 0;
 bool important_cascade = 0;
 
-std::vector<std::unique_ptr<Object>> objects;
-
-material_t  buf_obj[WIND_W][WIND_H];
-float       buf_dist[WIND_W][WIND_H];
-SDL_FColor  buf_light[WIND_W][WIND_H];
-SDL_FColor ***buf_rc;
-int ray_w = sqrt(r0) * WIND_W / d0;
-int ray_h = sqrt(r0) * WIND_H / d0;
-material_t* buffer_ptr = (material_t*)buf_obj;
-SDL_FColor* m_buf;
+// frames computed ahead of the one on screen, 0 computes and presents in turn
+int pipeline_depth = 1;
+frame_pipeline_t pipeline;
 
+// light_scale for frames with a drag in them, the others gather every pixel;
+// `dragged` is set and taken on the solver thread
+int drag_light_scale = 4;
+bool dragged = false;
 
 using namespace std;
 
-SDL_FColor ray_march(vec2 r_orig, vec2 r_dir, float r_len) {
-    SDL_FColor hit = {0.0, 0.0, 0.0, 1.0};
-    material_t hit_material;
-    float distance, tot_distance = 0;
-    vec2 position; 
-    while (tot_distance < r_len) {
-        position = r_orig + r_dir * tot_distance;
-
-        if (position.x < 0 || position.y < 0 || position.x > WIND_W || position.y > WIND_H) 
-            break;
-
-        distance = buf_dist[static_cast<int>(position.x)][static_cast<int>(position.y)];
-
-        if (distance < 0.001) {
-            hit_material = buf_obj[static_cast<int>(position.x)][static_cast<int>(position.y)];
-            hit = {hit_material.color.r * hit_material.emissivity, hit_material.color.g * hit_material.emissivity,
-                   hit_material.color.b * hit_material.emissivity, 0.0};
-            break;
-        }
-
-        tot_distance += distance;
-    }
-
-    return hit;
-}
-
-void fill_buf_obj() {
-    for (int x = 0; x < WIND_W; ++x)
-        for (int y = 0; y < WIND_H; ++y)
-            buf_obj[x][y] = material_t({0,0,0,0},0);
-    for (int i = 0; i < objects.size(); ++i)
-        objects[i]->draw(buffer_ptr, WIND_W, WIND_H);
-}
-void fill_buf_dist() {
-    for (int x = 0; x < WIND_W; ++x) {
-        for (int y = 0; y < WIND_H; ++y) {
-            float min = diagonal;
-            float dist;
-            for (int i = 0; i < objects.size(); ++i) {
-                dist = objects[i]->sdf(vec2(x, y));
-                if (dist < min) min = dist;
-            }
-            if (min < 0) min = 0;
-            buf_dist[x][y] = min;
-        }
-    }
-}
-
-void merge_cascades() {
-    vec2 px_pos;
-    int dn = d0 * pow(s_res_factor, max_cascade);
-    int rn = sqrt(r0 * pow(a_res_factor, max_cascade));
-    int rn_sq = r0 * pow(a_res_factor, max_cascade);
-
-    float sum_rad[4] = {0.0,0.0,0.0,0.0};
-    SDL_FColor bl_rad;
-
-    for (int x = 0; x < WIND_W; ++x) {
-    for (int y = 0; y < WIND_H; ++y) {
-
-        //vec2 m_pos = vec2(floor(mouse_x/dn-0.5), floor(mouse_y/dn-0.5)) * dn + vec2(dn,dn)*0.5;
-        //m_pos = vec2(abs(m_pos.x), abs(m_pos.y));
-        px_pos = vec2(floor(x/dn-0.5), floor(y/dn-0.5));// + vec2(dn,dn)*0.5;
-        px_pos = vec2(abs(px_pos.x), abs(px_pos.y));
-        if (static_cast<int>((px_pos.x+1)*rn) < ray_w && 
-            static_cast<int>((px_pos.y+1)*rn) < ray_h) {
-            for (int r = 0; r < rn_sq; ++r) {
-                m_buf[r] = b_intrp(vec2(x,y),
-                    (px_pos) * dn,
-                    (px_pos + vec2(1.0, 0.0)) * dn,
-                    (px_pos + vec2(0.0, 1.0)) * dn,
-                    (px_pos + vec2(1.0, 1.0)) * dn,
-                    buf_rc[max_cascade][static_cast<int>( px_pos.x      * rn + (r%rn))][static_cast<int>( px_pos.y      * rn + floor(r/rn))],
-                    buf_rc[max_cascade][static_cast<int>((px_pos.x + 1) * rn + (r%rn))][static_cast<int>( px_pos.y      * rn + floor(r/rn))],
-                    buf_rc[max_cascade][static_cast<int>( px_pos.x      * rn + (r%rn))][static_cast<int>((px_pos.y + 1) * rn + floor(r/rn))],
-                    buf_rc[max_cascade][static_cast<int>((px_pos.x + 1) * rn + (r%rn))][static_cast<int>((px_pos.y + 1) * rn + floor(r/rn))]);
-            }
-        }
-        else {
-            for (int r = 0; r < rn_sq; ++r) {
-                m_buf[r] = buf_rc[max_cascade][static_cast<int>(px_pos.x * rn + (r%rn))][static_cast<int>(px_pos.y * rn + floor(r/rn))];
-            }
-        }
-        
-        for (int Cn = max_cascade - 1; Cn >= 0; --Cn) {
-            dn = d0 * pow(s_res_factor, Cn);
-            rn = sqrt(r0 * pow(a_res_factor, Cn));
-            rn_sq = r0 * pow(a_res_factor, Cn);
-            px_pos = vec2(floor(x/dn-0.5), floor(y/dn-0.5));// * dn + vec2(dn,dn)*0.5;
-            px_pos = vec2(abs(px_pos.x), abs(px_pos.y));
-            if (static_cast<int>((px_pos.x+1)*rn) < ray_w && 
-                static_cast<int>((px_pos.y+1)*rn) < ray_h) {
-                for (int r = 0; r < rn_sq; ++r) {
-                    sum_rad[0] =sum_rad[1] =sum_rad[2] =sum_rad[3] = 0.0;
-                    bl_rad = b_intrp(vec2(x,y),
-                        (px_pos) * dn,
-                        (px_pos + vec2(1.0, 0.0)) * dn,
-                        (px_pos + vec2(0.0, 1.0)) * dn,
-                        (px_pos + vec2(1.0, 1.0)) * dn,
-                        // (px_pos + vec2(0.5, 0.5)) * dn,
-                        // (px_pos + vec2(1.5, 0.5)) * dn,
-                        // (px_pos + vec2(0.5, 1.5)) * dn,
-                        // (px_pos + vec2(1.5, 1.5)) * dn,
-                        buf_rc[Cn][static_cast<int>( px_pos.x      * rn + (r%rn))][static_cast<int>( px_pos.y      * rn + floor(r/rn))],
-                        buf_rc[Cn][static_cast<int>((px_pos.x + 1) * rn + (r%rn))][static_cast<int>( px_pos.y      * rn + floor(r/rn))],
-                        buf_rc[Cn][static_cast<int>( px_pos.x      * rn + (r%rn))][static_cast<int>((px_pos.y + 1) * rn + floor(r/rn))],
-                        buf_rc[Cn][static_cast<int>((px_pos.x + 1) * rn + (r%rn))][static_cast<int>((px_pos.y + 1) * rn + floor(r/rn))]);
-                    if (bl_rad.a != 0.0) { // means didn't catch anything
-                        for (int k = 0; k < a_res_factor; ++k) {
-                            sum_rad[0] += m_buf[r * a_res_factor + k].r; 
-                            sum_rad[1] += m_buf[r * a_res_factor + k].b; 
-                            sum_rad[2] += m_buf[r * a_res_factor + k].b;
-                            sum_rad[3] += m_buf[r * a_res_factor + k].a;
-                        }
-                        m_buf[r]   = {bl_rad.r + bl_rad.a * (sum_rad[0] / a_res_factor),
-                                      bl_rad.g + bl_rad.a * (sum_rad[1] / a_res_factor),
-                                      bl_rad.b + bl_rad.a * (sum_rad[2] / a_res_factor),
-                                      bl_rad.a * sum_rad[3] / a_res_factor};
-                    }
-                    else
-                        m_buf[r]   = bl_rad;
-                }
-            }
-            else {
-                for (int r = 0; r < rn_sq; ++r) {
-                    sum_rad[0] =sum_rad[1] =sum_rad[2] =sum_rad[3] = 0.0;
-                    bl_rad = buf_rc[Cn][static_cast<int>(px_pos.x * rn + (r%rn))][static_cast<int>(px_pos.y * rn + floor(r/rn))];
-                    if (bl_rad.a != 0.0) {
-                        for (int k = 0; k < a_res_factor; ++k) {
-                            sum_rad[0] += m_buf[r * a_res_factor + k].r; 
-                            sum_rad[1] += m_buf[r * a_res_factor + k].b; 
-                            sum_rad[2] += m_buf[r * a_res_factor + k].b;
-                            sum_rad[3] += m_buf[r * a_res_factor + k].a;
-                        }
-                        m_buf[r]   = {bl_rad.r + bl_rad.a * (sum_rad[0] / a_res_factor),
-                                      bl_rad.g + bl_rad.a * (sum_rad[1] / a_res_factor),
-                                      bl_rad.b + bl_rad.a * (sum_rad[2] / a_res_factor),
-                                      bl_rad.a * sum_rad[3] / a_res_factor};
-                    }
-                    else
-                        m_buf[r]   = bl_rad;
-                }
-            }
-        }
-        
-        sum_rad[0] =sum_rad[1] =sum_rad[2] =sum_rad[3] = 0.0;
-        for (int k = 0; k < r0; ++k) {
-            sum_rad[0] += m_buf[k].r; 
-            sum_rad[1] += m_buf[k].g; 
-            sum_rad[2] += m_buf[k].b;
-        }
-        buf_light[x][y] = {sum_rad[0]/r0, sum_rad[1]/r0, sum_rad[2]/r0, 1.0};
-    }}
-}
-
-void compute_cascade(int Cn) {
-    int rn = sqrt(r0 * pow(a_res_factor, Cn));
-    int dn = d0 * pow(s_res_factor, Cn);
-
-    vec2 probe_centre; 
-
-    float   r_start = rl0 * (1 - pow(ray_len_factor, Cn)) / (1 - ray_len_factor);
-    float   r_len   = rl0 * pow(ray_len_factor, Cn); 
-    int     r_ind;
-    float   r_ang;
-    vec2    r_dir, r_orig;
-
-    for (int x = 0; x < ray_w; ++x) {
-    for (int y = 0; y < ray_h; ++y) {
-        probe_centre = vec2(floor(x/rn), floor(y/rn)) * dn + vec2(dn,dn)*0.5;
-
-        r_ind  = (x % rn) + (y % rn) * rn;
-        r_ang  = TAU * (r_ind + 0.5) / (rn * rn);
-
-        r_dir  = vec2(cos(r_ang), sin(r_ang));
-        r_orig = probe_centre + (r_dir * r_start);
-        
-        buf_rc[Cn][x][y] = ray_march(r_orig, r_dir, r_len);
-    }}
-}
-
-void compute() {
-    fill_buf_obj();
-    
-    fill_buf_dist();
-    for (int i = max_cascade; i >= 0; --i) {
-        compute_cascade(i);
-    }
-    if (render_illumination) {
-        merge_cascades();
-    }
-}
-
-
 void draw_circle(SDL_Renderer* renderer, vec2 center, float radius, SDL_FColor color, int numSegments = 19) {
     SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
 
@@ -274,22 +67,8 @@ void draw_circle(SDL_Renderer* renderer, vec2 center, float radius, SDL_FColor c
 
     SDL_RenderGeometry(renderer, nullptr, vertices.data(), vertices.size(), indices.data(), indices.size());
 }
-void draw_objects(SDL_Renderer* renderer) {
-    for (int x = 0; x < WIND_W; ++x) {
-        for (int y = 0; y < WIND_H; ++y) {
-            if (buf_obj[x][y].color.a == 0) continue;
-            SDL_SetRenderDrawColor(renderer, 
-                                   (Uint8)(buf_obj[x][y].color.r * 255),
-                                   (Uint8)(buf_obj[x][y].color.g * 255),
-                                   (Uint8)(buf_obj[x][y].color.b * 255),
-                                   (Uint8)(buf_obj[x][y].color.a * 255));
-            
-            SDL_RenderPoint(renderer, x, y);
-        }
-    }
-}
-
-void draw_rays_RC(SDL_Renderer* renderer, int Cn, bool draw_rays) {
+// ray colours come from `frame` when pipelined, buf_rc is busy with the next one
+void draw_rays_RC(SDL_Renderer* renderer, int Cn, bool draw_rays, const pipeline_frame_t* frame) {
     SDL_FColor color;
     switch (Cn) {
         case 0: color = {0.98, 0.27, 0.27, 1.0}; break;
@@ -307,28 +86,25 @@ void draw_rays_RC(SDL_Renderer* renderer, int Cn, bool draw_rays) {
                                    (Uint8)(color.b * 255),
                                    (Uint8)(color.a * 255));
 
-    int rn = sqrt(r0 * pow(a_res_factor, Cn));
-    int dn = d0 * pow(s_res_factor, Cn);
+    const cascade_desc_t& c = cascade_desc[Cn];
+    int rn = c.rn;
+    int dn = c.dn;
 
-    float r_start = rl0 * (1 - pow(ray_len_factor, Cn)) / (1 - ray_len_factor);
-    float r_len   = rl0 * pow(ray_len_factor, Cn); 
+    float r_len   = c.r_len;
     vec2 m_pos = vec2(floor(mouse_x/dn-0.5), floor(mouse_y/dn-0.5)) * dn + vec2(dn,dn)*0.5;
     m_pos = vec2(abs(m_pos.x), abs(m_pos.y));
 
     //printf("m_pos: (%f, %f)\n", m_pos.x, m_pos.y);
     for (int x = 0; x < ray_w; ++x) {
     for (int y = 0; y < ray_h; ++y) {
-        vec2 probe = vec2(floor(x/rn), floor(y/rn));
-        vec2 probe_centre = probe * dn + vec2(dn,dn)*0.5;
+        vec2 probe_centre = vec2(c.centre[x / rn], c.centre[y / rn]);
 
         //draw_circle(renderer, probe_centre, 2 * (1 + Cn), color, 3 * (1 + Cn));
         if (draw_rays) {
             int    r_ind  = (x % rn) + (y % rn) * rn;
 
-            float   r_ang  = TAU * (r_ind + 0.5) / (rn * rn);
-
-            vec2    r_dir  = vec2(cos(r_ang), sin(r_ang));
-            vec2    r_orig = probe_centre + (r_dir * r_start);
+            vec2    r_dir  = c.dir[r_ind];
+            vec2    r_orig = probe_centre + c.start[r_ind];
             
             if (important_cascade) {
                 
@@ -347,7 +123,7 @@ void draw_rays_RC(SDL_Renderer* renderer, int Cn, bool draw_rays) {
                 }
             }
             else {
-                color = buf_rc[Cn][x][y];
+                color = frame ? frame->rays[(static_cast<size_t>(Cn) * ray_w + x) * ray_h + y] : buf_rc[Cn].at(x, y);
                 SDL_SetRenderDrawColor(renderer, 
                                 (Uint8)(color.r * 255),
                                 (Uint8)(color.g * 255),
@@ -377,8 +153,8 @@ void draw_rays_HRC(SDL_Renderer* renderer, int Cn, int dir, bool draw_rays) {
                                    (Uint8)(color.b * 255),
                                    (Uint8)(color.a * 255));
 
-    for (int x = 0; x < ceil(WIND_W/(1 << Cn)); ++x) {
-    for (int y = 0; y < ceil(WIND_H/(1 << Cn)); y += 1) {
+    for (int x = 0; x < ceil(scr_w/(1 << Cn)); ++x) {
+    for (int y = 0; y < ceil(scr_h/(1 << Cn)); y += 1) {
         vec2 probe_centre = vec2(x * (1<<Cn), y * (1<<Cn));
         //draw_circle(renderer, probe_centre, 1, color, 3);
         if (draw_rays) 
@@ -395,77 +171,157 @@ void draw_rays_HRC(SDL_Renderer* renderer, int Cn, int dir, bool draw_rays) {
     }}
 }
 
-void draw_lighting(SDL_Renderer* renderer) {
-    for (int x = 0; x < WIND_W; ++x) {
-        for (int y = 0; y < WIND_H; ++y) {
-            SDL_SetRenderDrawColor(renderer, 
-                                   (Uint8)(buf_light[x][y].r * 255),
-                                   (Uint8)(buf_light[x][y].g * 255),
-                                   (Uint8)(buf_light[x][y].b * 255),
-                                   (Uint8)(/*buf_light[x][y].a * */255));
-            SDL_RenderPoint(renderer, x, y);
+// distance map, lighting and objects as one texture
+present_layers_t viewer_layers() {
+    present_layers_t layers;
+    layers.dist    = render_dist_map;
+    layers.light   = render_illumination;
+    layers.objects = render_objects;
+    return layers;
+}
+
+// reduced lighting while dragging, a static frame refines it
+void compute_viewer() {
+    light_scale = dragged ? drag_light_scale : 1;
+    dragged = false;
+    compute(render_illumination);
+}
+
+// the solver thread's half of a pipelined frame: compute, composite the
+// layers and keep the ray colours for the overlay
+void compute_frame(pipeline_frame_t& f) {
+    {
+        profile_scope_t scope("frame");
+        compute_viewer();
+
+        present_layers_t layers = viewer_layers();
+        f.pixels.clear();
+        if (layers.dist || layers.light || layers.objects) {
+            f.pixels.resize(static_cast<size_t>(scr_w) * scr_h);
+            fill_present(layers, reinterpret_cast<Uint8*>(f.pixels.data()), scr_w * 4);
         }
+        f.rays.clear();
+        if (render_rays_RC)
+            for (int Cn = 0; Cn <= max_cascade; ++Cn)
+                for (int x = 0; x < ray_w; ++x)
+                    for (int y = 0; y < ray_h; ++y) f.rays.push_back(buf_rc[Cn].at(x, y));
+        f.number = profile_frame;
     }
+    ++profile_frame;
 }
 
-void render(SDL_Renderer* renderer) {
+// draws `frame` when pipelined, the current buffers otherwise
+void render(SDL_Renderer* renderer, const pipeline_frame_t* frame = nullptr) {
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
 
-    if (render_dist_map) {
-        for (int x = 0; x < WIND_W; ++x) {
-            for (int y = 0; y < WIND_H; ++y) {
-                SDL_SetRenderDrawColor(renderer, 
-                                       (Uint8)(buf_dist[x][y] * 255 / diagonal),
-                                       (Uint8)(buf_dist[x][y] * 255 / diagonal),
-                                       (Uint8)(buf_dist[x][y] * 255 / diagonal),
-                                       (Uint8)(buf_dist[x][y] * 255 / diagonal));
-                SDL_RenderPoint(renderer, x, y);
-            }
-        }
+    {
+        profile_scope_t scope("layers");
+        if (!frame)                      present_layers(renderer, viewer_layers());
+        else if (!frame->pixels.empty()) present_image(renderer, frame->pixels.data());
     }
-    
-    if (render_illumination) draw_lighting(renderer);
-
-    if (render_objects) draw_objects(renderer);
 
     if (render_rays_RC) {
-        for (int i = 0; i <= max_cascade; ++i)
-            draw_rays_RC(renderer, i, true);
+        for (int i = 0; i <= max_cascade; ++i) {
+            profile_scope_t scope("rays", i);
+            draw_rays_RC(renderer, i, true, frame);
+        }
     }
     if (render_rays_HRC) {
+        profile_scope_t scope("hrc rays");
         //for (int i = 0; i <= max_cascade; ++i)
             draw_rays_HRC(renderer, 3, 0, true);
     }
 
+    profile_scope_t scope("present");
     SDL_RenderPresent(renderer);
 }
 
-void load_obj() {
-    int r = 50;
-    objects.push_back(make_unique<Rectangle>(vec2(WIND_W * 0.375, WIND_H * 0.375), vec2(r, r/2), material_t({0x40/255.0f, 0x40/255.0f, 0x40/255.0f, 1.0}, 0.0f)));
-    
-    objects.push_back(make_unique<Circle>(vec2(WIND_W * 0.50, WIND_H * 0.50), 25, material_t({0xff/255.0f, 0xf0/255.0f, 0xe3/255.0f, 1.0f}, 1.0f)));
-    objects.push_back(make_unique<Circle>(vec2(WIND_W * 0.25, WIND_H * 0.25), r/4, material_t({0xff/255.0f, 0x10/255.0f, 0x00/255.0f, 1.0f}, 1.0f)));
-    objects.push_back(make_unique<Circle>(vec2(WIND_W * 0.75, WIND_H * 0.25), r/4, material_t({0x00/255.0f, 0xff/255.0f, 0x00/255.0f, 1.0f}, 1.0f)));
-    objects.push_back(make_unique<Circle>(vec2(WIND_W * 0.25, WIND_H * 0.75), r/2, material_t({0x00/255.0f, 0x20/255.0f, 0xff/255.0f, 1.0f}, 1.0f)));
-    //objects.push_back(make_unique<Circle>(vec2(WIND_W * 0.75, WIND_H * 0.75), 25, material_t({0xfc/255.0f, 0x51/255.0f, 0x69/255.0f, 1.0f}, 1.0f)));
+// keys run as edits, on the solver thread when pipelined
+void handle_key(SDL_Keycode key) {
+    // D - switch distance field builder, C - compare both against each other,
+    // H - switch between classic and holographic cascades,
+    // A - amortise the cascades above 0 over 2, 4, 8.. frames or stop that,
+    // M - march over the distance pyramid or the plain field,
+    // T - sphere tracing, DDA, or the faster of both per cascade,
+    // P - march over the packed cells or the float field,
+    // L - gather the lighting at 1/1, 1/2 or 1/4 resolution while dragging,
+    // F - start recording a profile, or write it to profile.csv/.json
+    if (key == SDLK_D) {
+        dist_mode = dist_mode == DIST_EDT ? DIST_ANALYTIC : DIST_EDT;
+        invalidate_scene();
+        printf("Distance field: %s\n", dist_mode == DIST_EDT ? "EDT" : "analytic");
+    }
+    else if (key == SDLK_C) compare_dist_modes();
+    else if (key == SDLK_A) {
+        if (cascade_period.empty())
+            for (int Cn = 0; Cn <= max_cascade; ++Cn) cascade_period.push_back(1 << std::min(Cn, 3));
+        else
+            cascade_period.clear();
+        invalidate_scene();
+        printf("Amortised cascades: %s\n", cascade_period.empty() ? "off" : "on");
+    }
+    else if (key == SDLK_M) {
+        march_mip = !march_mip;
+        invalidate_scene();
+        printf("Distance pyramid: %s\n", march_mip ? "on" : "off");
+    }
+    else if (key == SDLK_F) {
+        if (!profiling) {
+            profile_start();
+            printf("Profiling\n");
+        }
+        else {
+            profiling = false;
+            write_profile("profile");
+        }
+    }
+    else if (key == SDLK_P) {
+        set_cells(!march_cells);
+        printf("Packed cells: %s\n", march_cells ? "on" : "off");
+    }
+    else if (key == SDLK_L) {
+        drag_light_scale = drag_light_scale >= 4 ? 1 : drag_light_scale * 2;
+        printf("Lighting while dragging: 1/%d resolution\n", drag_light_scale);
+    }
+    else if (key == SDLK_T) {
+        set_tracer((tracer_mode + 1) % 3);
+        printf("Tracer: %s\n", tracer_mode == TRACER_SPHERE ? "sphere tracing" : tracer_mode == TRACER_DDA ? "DDA" : "auto");
+    }
+    else if (key == SDLK_H) {
+        set_solver(solver == SOLVER_RC ? SOLVER_HRC : SOLVER_RC);
+        printf("Solver: %s\n", solver == SOLVER_RC ? "radiance cascades" : "holographic radiance cascades");
+    }
+}
+
+// scene and solver changes go through the pipeline while it runs, so they
+// land between two frames on the solver thread
+void apply_edit(std::function<void()> edit) {
+    if (pipeline.running()) pipeline.post(std::move(edit));
+    else                    edit();
+}
+
+// picks the object under the mouse and moves it there
+void drag_at(vec2 p) {
+    apply_edit([p] {
+        int drag_obj = pick_object(p);
+        if (drag_obj >= 0) {
+            move_object(drag_obj, p);
+            dragged = true;
+        }
+    });
 }
 
 void handle_input() {
     while(SDL_PollEvent(&event)) {
         if(event.type == SDL_EVENT_QUIT) quit = true;
+        else if(event.type == SDL_EVENT_KEY_DOWN) {
+            SDL_Keycode key = event.key.key;
+            apply_edit([key] { handle_key(key); });
+        }
         else if(event.button.button == SDL_BUTTON_LEFT){
             SDL_GetMouseState(&mouse_x, &mouse_y);
-            float min = diagonal;
-            int drag_obj;
-            for (drag_obj = 0; drag_obj < objects.size(); ++drag_obj) {
-                if (objects[drag_obj]->sdf(vec2(mouse_x, mouse_y)) <= 0.0f) { 
-                    //printf("PICKING OBJECT %d\n", drag_obj);
-                    objects[drag_obj]->centre = vec2(mouse_x, mouse_y);
-                    break;
-                }
-            }
+            drag_at(vec2(mouse_x, mouse_y));
             // if (SDL_GetModState() & KMOD_SHIFT)
             //     set_cell_to(&(cells[ROW_NUM-1 - mouse_y/CELL_SIZE][mouse_x/CELL_SIZE]), solid);
             // else {
@@ -476,21 +332,38 @@ void handle_input() {
         else if(event.button.button == SDL_BUTTON_RIGHT) {
             important_cascade ^= true;
             SDL_GetMouseState(&mouse_x, &mouse_y);
-            float min = diagonal;
-            int drag_obj;
-            for (drag_obj = 0; drag_obj < objects.size(); ++drag_obj) {
-                if (objects[drag_obj]->sdf(vec2(mouse_x, mouse_y)) <= 0.0f) { 
-                    //printf("PICKING OBJECT %d\n", drag_obj);
-                    objects[drag_obj]->centre = vec2(mouse_x, mouse_y);
-                    break;
-                }
-            }
+            drag_at(vec2(mouse_x, mouse_y));
         }
     }
     
 }
 
+void usage() {
+    printf("usage: blank [options] [SCENE]\n"
+           "  SCENE              built-in scene (default, scatter[:N], maze[:N], emitters[:N])\n"
+           "                     or a scene file, default the default scene\n"
+           "  -t N               worker threads, 0 = all\n"
+           "  -d                 deterministic scheduling\n"
+           "  --rc-format f32|f16|rgb9e5     storage of the cascade rays, default f32\n"
+           "  --light-format f32|f16|rgb9e5  storage of the lighting, default f32\n"
+           "  --pipeline N       frames computed ahead of the one on screen, default 1\n");
+}
+
 int main(int argc, char* argv[]) {
+    const char* scene = "default";
+    for (int i = 1; i < argc; ++i) {
+        if      (!strcmp(argv[i], "-t") && i + 1 < argc) n_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d"))                 deterministic = true;
+        else if (!strcmp(argv[i], "--rc-format") && i + 1 < argc)    cascade_format = parse_color_format(argv[++i]);
+        else if (!strcmp(argv[i], "--light-format") && i + 1 < argc) light_format = parse_color_format(argv[++i]);
+        else if (!strcmp(argv[i], "--pipeline") && i + 1 < argc)     pipeline_depth = std::max(0, atoi(argv[++i]));
+        else if (argv[i][0] != '-')                      scene = argv[i];
+        else {
+            usage();
+            return strcmp(argv[i], "--help") ? 1 : 0;
+        }
+    }
+
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_Window* window = SDL_CreateWindow("blank", WIND_W, WIND_H, 0);
@@ -508,48 +381,52 @@ int main(int argc, char* argv[]) {
         return -1;
     }
     
-    load_obj();
-
-
-    int factor = ceil(log<float>(diagonal / d0) / log<float>(ray_len_factor));
-    
-    int intervalstart = (d0 * (1.0 - pow((s_res_factor * s_res_factor), factor))) / (1.0 - (s_res_factor * s_res_factor));
-    max_cascade = ceil(log(intervalstart) / log(s_res_factor * s_res_factor)) - 1;
-    printf("Will render %d cascades\n", (max_cascade + 1));
-
-
-
-    buf_rc = new SDL_FColor**[max_cascade + 1];
-    for (int b = 0; b <= max_cascade; ++b) {
-        buf_rc[b] = new SDL_FColor*[ray_w];
-        for (int i = 0; i < ray_w; ++i) {
-            buf_rc[b][i] = new SDL_FColor[ray_h];
-            for (int k = 0; k < ray_h; ++k) {
-                buf_rc[b][i][k] = {0.0f, 0.0f, 0.0f, 1.0f};
-            }
-        }
+    scr_w = WIND_W;
+    scr_h = WIND_H;
+    if (!init_solver() || !init_present(renderer)) {
+        free_solver();
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return -1;
     }
-
-    printf("Allocated %d buffers of %dx%d (%ldKB total)\n", max_cascade + 1,
-    static_cast<int>(ray_w), static_cast<int>(ray_h), 
-    (max_cascade + 1) * sizeof(SDL_FColor) * r0 * WIND_W * WIND_H / (d0 * d0 * 1024));
-    printf("Size of SDL_FColor is %ldB\n", sizeof(SDL_FColor));
-
-    for (int x = 0; x < WIND_W; ++x) {
-    for (int y = 0; y < WIND_H; ++y) {
-        buf_light[x][y] = {0.0, 0.0, 0.0, 1.0};
-    }}
-
-    m_buf = new SDL_FColor[static_cast<int>(r0 * std::pow(a_res_factor, max_cascade))];
-    for (int i = 0; i < static_cast<int>(r0 * std::pow(a_res_factor, max_cascade)); ++i) {
-        m_buf[i] = {0.0, 0.0, 0.0, 1.0};
+    if (!load_scene(scene)) {
+        cerr << "Could not load scene \"" << scene << "\", using the default one" << endl;
+        load_scene("default");
     }
+    #ifdef DEBUGG
+    fill_buf_obj();
+    compare_dist_modes();
+    #endif
 
+    if (pipeline_depth > 0) {
+        pipeline.start(pipeline_depth, compute_frame);
+        printf("Pipelined, computing up to %d frames ahead\n", pipeline_depth);
+    }
 
     Uint64 lastFrameTicks = 0;
     int frameCount = 0;
     float currentFPS = 0.0f;
     while (!quit) {
+        handle_input();
+
+        if (pipeline.running()) {
+            // short waits, so input keeps flowing while a slow frame computes
+            pipeline_frame_t* frame = pipeline.acquire(10);
+            if (!frame) continue;
+            profile_frame = frame->number;
+            render(renderer, frame);
+            pipeline.release(frame);
+        }
+        else {
+            {
+                profile_scope_t scope("frame");
+                compute_viewer();
+                render(renderer);
+            }
+            ++profile_frame;
+        }
+
         #ifdef SHOW_FPS
         // Calculate FPS
         Uint64 currentTicks = SDL_GetPerformanceCounter();
@@ -572,24 +449,15 @@ int main(int argc, char* argv[]) {
             lastSecondTicks = currentTicks;
         }
         #endif
-        handle_input();
-        
-        compute();
-        
-        render(renderer);
     }
+    pipeline.stop();
 
+    free_present();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
-    for (int b = 0; b <= max_cascade; ++b) {
-        for (int i = 0; i < ray_w; ++i)
-            delete[] buf_rc[b][i];
-        delete[] buf_rc[b];
-    }
-    delete[] buf_rc;
-    delete[] m_buf;
+    free_solver();
 
     return 0;
 }    
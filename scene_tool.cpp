@@ -0,0 +1,68 @@
+//
+//  scene_tool.cpp
+//  Converts scenes between the binary (.rcs) and the text form, and writes
+//  the built-in scenes out as files.
+//
+#include <SDL3/SDL.h>
+#include "headers/radiance.hpp"
+#include "headers/scenes.hpp"
+#include "headers/scene_file.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+void usage() {
+    printf("usage: rc_scene [-w W -h H] IN OUT\n"
+           "  IN     built-in scene (default, scatter[:N], maze[:N], emitters[:N]) or a scene file\n"
+           "  OUT    .rcs writes the binary form, anything else the text form\n"
+           "  -w W, -h H  size to lay built-in scenes out for and to record in OUT,\n"
+           "              default the size IN records or 512x512\n");
+}
+
+int main(int argc, char* argv[]) {
+    string in, out;
+    int w = 0, h = 0;
+    for (int i = 1; i < argc; ++i) {
+        string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if      (a == "-w" && has_val) w = atoi(argv[++i]);
+        else if (a == "-h" && has_val) h = atoi(argv[++i]);
+        else if (a[0] != '-' && in.empty())  in = a;
+        else if (a[0] != '-' && out.empty()) out = a;
+        else {
+            usage();
+            return a == "--help" ? 0 : 1;
+        }
+    }
+    if (in.empty() || out.empty()) {
+        usage();
+        return 1;
+    }
+
+    int file_w = 0, file_h = 0;
+    if (!is_builtin_scene(in)) scene_file_size(in, file_w, file_h);
+    scr_w = w > 0 ? w : file_w > 0 ? file_w : 512;
+    scr_h = h > 0 ? h : file_h > 0 ? file_h : 512;
+
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    if (!load_scene_objects(in)) {
+        fprintf(stderr, "Could not load scene \"%s\"\n", in.c_str());
+        return 1;
+    }
+    double t_load = ms_since(t0);
+
+    scene_text_t s;
+    scene_from_objects(objects, scr_w, scr_h, s);
+    bool binary = out.size() >= 4 && out.compare(out.size() - 4, 4, ".rcs") == 0;
+    t0 = SDL_GetPerformanceCounter();
+    bool ok = binary ? write_scene_binary(out, s) : write_scene_text(out, s);
+    if (!ok) {
+        fprintf(stderr, "Could not write \"%s\"\n", out.c_str());
+        return 1;
+    }
+    printf("%zu objects, %zu materials, %dx%d: loaded in %.3f ms, written in %.3f ms\n",
+           objects.size(), s.materials.size(), scr_w, scr_h, t_load, ms_since(t0));
+    return 0;
+}